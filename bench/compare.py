@@ -0,0 +1,58 @@
+#!/usr/bin/env python3
+"""Confronta i risultati JSON di bench/compile_throughput.sh e di
+bench/runtime.sh con quelli di una baseline salvata.
+
+Uso: bench/compare.py <baseline.json> <risultati.json> [soglia %]
+
+Per ogni benchmark presente in entrambi i file stampa la variazione delle
+metriche note; termina con codice 1 se almeno una peggiora oltre la soglia
+(default 5%).
+"""
+
+import json
+import sys
+
+# Metrica -> True se un valore più alto è migliore
+METRICS = {
+    "lines_per_second": True,
+    "peak_rss_kib": False,
+    "cpu_time": False,
+    "real_time": False,
+}
+
+
+def load(path):
+    with open(path) as f:
+        return {b["name"]: b for b in json.load(f)["benchmarks"]}
+
+
+def main():
+    if len(sys.argv) not in (3, 4):
+        sys.exit(__doc__)
+    baseline = load(sys.argv[1])
+    current = load(sys.argv[2])
+    threshold = float(sys.argv[3]) if len(sys.argv) == 4 else 5.0
+    regressions = 0
+
+    for name, result in current.items():
+        if name not in baseline:
+            print(f"{name}: nuovo")
+            continue
+        for metric, higher_is_better in METRICS.items():
+            old, new = baseline[name].get(metric), result.get(metric)
+            if not old or new is None:
+                continue
+            change = (new - old) / old * 100
+            worse = -change if higher_is_better else change
+            flag = "  PEGGIORATO" if worse > threshold else ""
+            regressions += bool(flag)
+            print(f"{name} {metric}: {old:g} -> {new:g} ({change:+.1f}%){flag}")
+
+    for name in baseline.keys() - current.keys():
+        print(f"{name}: mancante")
+
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
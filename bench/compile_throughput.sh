@@ -0,0 +1,97 @@
+#!/bin/sh
+# Misura il throughput di compilazione di kfe su sorgenti sintetici:
+#   defs       N definizioni brevi
+#   deep_expr  N/100 funzioni con espressioni annidate per 100 livelli
+#   long_args  N/100 funzioni con 64 parametri, ognuna chiama la precedente
+#   nested     N/1000 funzioni con 50 livelli di var/for annidati
+# Per ogni sorgente riporta righe al secondo e picco della memoria residente
+# del processo, e per ogni fase (da -stats) tempo, allocazioni e di quanto
+# la fase ha fatto crescere quel picco. I risultati vanno su stdout in JSON,
+# confrontabili con bench/compare.py.
+#
+# Uso: bench/compile_throughput.sh [N...]   (default: 10000 100000 1000000)
+# KFEFLAGS sceglie le opzioni di kfe (default -O0).
+# (da lanciare dalla radice del repository, dopo make)
+
+SIZES=${*:-10000 100000 1000000}
+KFE=${KFE:-bin/kfe}
+KFEFLAGS=${KFEFLAGS:--O0}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+generate() {
+    awk -v kind="$1" -v n="$2" 'BEGIN {
+        if (kind == "defs") {
+            for (f = 0; f < n; f++)
+                printf "def f%d(x y)\n  x * y + %d - x / (y + 1);\n", f, f
+        } else if (kind == "deep_expr") {
+            for (f = 0; f < n / 100; f++) {
+                printf "def deep%d(x)\n  ", f
+                for (d = 0; d < 100; d++) printf "("
+                printf "x"
+                for (d = 0; d < 100; d++) printf " %s %d)", (d % 3 == 0 ? "+" : d % 3 == 1 ? "*" : "-"), d + 1
+                printf ";\n"
+            }
+        } else if (kind == "long_args") {
+            for (f = 0; f < n / 100; f++) {
+                printf "def wide%d(", f
+                for (a = 0; a < 64; a++) printf "%sa%d", (a ? " " : ""), a
+                printf ")\n  "
+                if (f == 0) {
+                    printf "a0 + a63;\n"
+                    continue
+                }
+                printf "wide%d(", f - 1
+                for (a = 0; a < 64; a++) printf "%sa%d + 1", (a ? ", " : ""), 63 - a
+                printf ");\n"
+            }
+        } else if (kind == "nested") {
+            for (f = 0; f < n / 1000; f++) {
+                printf "def nested%d(x)\n", f
+                prev = "x"
+                for (d = 0; d < 50; d++) {
+                    printf "var v%d = %s, x = %s in for i%d = 0, i%d < 2 in\n", d, prev, prev, d, d
+                    prev = "v" d
+                }
+                printf "%s = %s + x\n", prev, prev
+                for (d = 0; d < 50; d++) printf "end end\n"
+                printf ";\n"
+            }
+        }
+    }'
+}
+
+printf '{\n  "context": {"kfe": "%s", "flags": "%s"},\n  "benchmarks": [' "$KFE" "$KFEFLAGS"
+separator=""
+for size in $SIZES; do
+    for kind in defs deep_expr long_args nested; do
+        generate "$kind" "$size" > "$TMP/$kind.k"
+        lines=$(wc -l < "$TMP/$kind.k")
+
+        # shellcheck disable=SC2086
+        if ! "$KFE" $KFEFLAGS -stats -o "$TMP/$kind" "$TMP/$kind.k" > /dev/null 2> "$TMP/$kind.stats"; then
+            echo "$kind/$size: compilazione fallita" >&2
+            continue
+        fi
+
+        # Le righe "Fase: X ms, N allocations, peak RSS +K KiB" e
+        # "Peak RSS: N KiB" di -stats
+        awk -v name="$kind/$size" -v lines="$lines" -v sep="$separator" '
+            /^(Parse|AST passes|Codegen|Cache store|Optimize|Emit): .* ms, .* allocations, peak RSS \+[0-9]+ KiB$/ {
+                phase = $0
+                sub(/:.*/, "", phase)
+                ms = $(NF - 7); allocations = $(NF - 5); growth = substr($(NF - 1), 2)
+                phases = phases sprintf("%s\"%s\": {\"ms\": %s, \"allocations\": %s, \"rss_growth_kib\": %s}",
+                                        (phases == "" ? "" : ", "), phase, ms, allocations, growth)
+                total += ms
+            }
+            /^Peak RSS:/ { rss = $3 }
+            END {
+                printf "%s\n    {\"name\": \"%s\", \"lines\": %d, \"lines_per_second\": %.0f, \"peak_rss_kib\": %d, \"phases\": {%s}}",
+                       sep, name, lines, (total > 0 ? lines * 1000 / total : 0), rss, phases
+            }' "$TMP/$kind.stats"
+        separator=","
+        rm -f "$TMP/$kind".*
+    done
+done
+printf '\n  ]\n}\n'
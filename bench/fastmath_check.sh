@@ -0,0 +1,98 @@
+#!/bin/sh
+# Confronta l'output dei programmi di esempio compilati in modo stretto
+# (IEEE 754) e con i flag fast-math indicati, per verificare che le
+# ottimizzazioni non ne alterino i risultati oltre una tolleranza.
+#
+# Ogni programma viene eseguito una volta per ciascun vettore di input
+# (negativi, zeri, grandezze grandi e piccole), passato sullo standard
+# input; i risultati sono stampati con 17 cifre significative. Due valori
+# sono accettati se |a - b| <= TOL * max(|a|, |b|): con il default
+# TOL=1e-12 l'errore relativo resta entro circa 4500 ULP.
+#
+# Uso: bench/fastmath_check.sh [flag fast-math...]   (default: -ffast-math)
+# (da lanciare dalla radice del repository, dopo make)
+
+FLAGS=${*:--ffast-math}
+KFE=${KFE:-bin/kfe}
+CXX=${CXX:-c++}
+TOL=${TOL:-1e-12}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+status=0
+
+# Coppie "x y": senza infiniti, NaN e divisioni per zero, su cui fast-math
+# non dà garanzie, e senza risultati denormali
+INPUTS="-3 2|0 1|-0.0 -7.5|1e150 -3e149|1e-150 7e-151|123.456 -0.001|-1e10 1e-10|40 2"
+# Gli esempi in cui x è il numero di iterazioni di un ciclo
+LOOP_INPUTS="-1e150|-3|0|1e-150|1|2|10|40|78"
+
+# Incluso in ogni main.cc: stampa con tutte le cifre di un double
+cat > "$TMP/precision.hh" <<'EOF'
+#include <iostream>
+static const bool kfeFullPrecision = (std::cout.precision(17), true);
+EOF
+
+# Confronta due output riga per riga; i numeri con la tolleranza, il resto
+# esattamente. Stampa l'errore relativo massimo, esce con 1 se supera TOL.
+compare() {
+    paste -d '\n' "$1" "$2" | awk -v tol="$TOL" '
+        function isnum(s) { return s ~ /^[-+]?([0-9]+\.?[0-9]*|\.[0-9]+)([eE][-+]?[0-9]+)?$/ }
+        function abs(v) { return v < 0 ? -v : v }
+        NR % 2 == 1 { strict = $0; next }
+        {
+            if (strict == $0) next
+            a = strict; b = $0
+            gsub(/[(),=:]/, " ", a); gsub(/[(),=:]/, " ", b)
+            na = split(a, ta, " "); nb = split(b, tb, " ")
+            if (na != nb) { print "    " strict " | " $0; bad = 1; next }
+            for (i = 1; i <= na; i++) {
+                if (ta[i] == tb[i]) continue
+                if (!isnum(ta[i]) || !isnum(tb[i])) { print "    " strict " | " $0; bad = 1; break }
+                x = ta[i] + 0; y = tb[i] + 0
+                scale = abs(x) > abs(y) ? abs(x) : abs(y)
+                err = scale ? abs(x - y) / scale : 0
+                if (err > maxerr) maxerr = err
+                if (err > tol) { print "    " strict " | " $0; bad = 1; break }
+            }
+        }
+        END { printf "%g\n", maxerr; exit bad }'
+}
+
+for dir in kaleidoscope-examples/*/; do
+    name=$(basename "$dir")
+    [ -f "$dir/main.cc" ] || continue
+
+    for mode in strict fast; do
+        opts="-O2"
+        [ "$mode" = fast ] && opts="-O2 $FLAGS"
+        # shellcheck disable=SC2086
+        "$KFE" $opts -o "$TMP/$name-$mode" "$dir"/*.k 2>/dev/null &&
+            "$CXX" -include "$TMP/precision.hh" -o "$TMP/$name-$mode" "$dir/main.cc" "$TMP/$name-$mode.o" ||
+            { echo "$name: compilazione ($mode) fallita"; status=1; continue 2; }
+    done
+
+    case "$name" in
+        varexpr | whileexpr) inputs=$LOOP_INPUTS ;;
+        *) inputs=$INPUTS ;;
+    esac
+
+    for mode in strict fast; do
+        : > "$TMP/$name-$mode.out"
+        echo "$inputs" | tr '|' '\n' | while read -r input; do
+            echo "$input" | "$TMP/$name-$mode" >> "$TMP/$name-$mode.out" 2>&1
+            echo >> "$TMP/$name-$mode.out"
+        done
+    done
+
+    if cmp -s "$TMP/$name-strict.out" "$TMP/$name-fast.out"; then
+        echo "$name: identico"
+    elif maxerr=$(compare "$TMP/$name-strict.out" "$TMP/$name-fast.out" > "$TMP/diff.txt"; status=$?; tail -n 1 "$TMP/diff.txt"; exit $status); then
+        echo "$name: entro la tolleranza (errore relativo massimo $maxerr)"
+    else
+        echo "$name: diverso oltre la tolleranza $TOL (strict | fast)"
+        sed '$d' "$TMP/diff.txt"
+        status=1
+    fi
+done
+
+exit $status
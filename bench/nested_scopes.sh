@@ -0,0 +1,31 @@
+#!/bin/sh
+# Misura il tempo di generazione del codice su funzioni con blocchi var/for
+# annidati in profondità, il caso che stressa di più la symbol table.
+#
+# Uso: bench/nested_scopes.sh [profondità] [funzioni]
+# (da lanciare dalla radice del repository, dopo make)
+
+DEPTH=${1:-200}
+FUNCS=${2:-50}
+KFE=${KFE:-bin/kfe}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+awk -v depth="$DEPTH" -v funcs="$FUNCS" 'BEGIN {
+    for (f = 0; f < funcs; f++) {
+        printf "def nested%d(x)\n", f
+        prev = "x"
+        for (d = 0; d < depth; d++) {
+            # Ogni livello nasconde x, così anche il ripristino viene misurato
+            printf "var v%d = %s, x = %s in for i%d = 0, i%d < 2 in\n", d, prev, prev, d, d
+            prev = "v" d
+        }
+        printf "%s = %s + x\n", prev, prev
+        for (d = 0; d < depth; d++)
+            printf "end end\n"
+        printf ";\n"
+    }
+}' > "$TMP/nested.k"
+
+echo "$FUNCS funzioni, profondità $DEPTH"
+"$KFE" -stats -o "$TMP/nested" "$TMP/nested.k" 2>&1 >/dev/null | grep -E "^(Codegen|AST arena):"
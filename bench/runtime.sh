@@ -0,0 +1,25 @@
+#!/bin/sh
+# Compila i kernel di kaleidoscope-examples (fib da whileexpr, arr, gli
+# operatori, forexpr) e quelli sugli array di bench/runtime/kernels.k, li
+# collega a bench/runtime/harness.cc e ne misura il tempo di esecuzione.
+# I risultati vanno su stdout in JSON, nel formato di Google Benchmark.
+#
+# Uso: bench/runtime.sh [flag di kfe...]   (default: -O2)
+# (da lanciare dalla radice del repository, dopo make)
+
+FLAGS=${*:--O2}
+KFE=${KFE:-bin/kfe}
+CXX=${CXX:-c++}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+# shellcheck disable=SC2086
+"$KFE" $FLAGS -o "$TMP" \
+    kaleidoscope-examples/whileexpr/whileexpr.k \
+    kaleidoscope-examples/array/array.k \
+    kaleidoscope-examples/operators/operators.k \
+    kaleidoscope-examples/forexpr/forexpr.k \
+    bench/runtime/kernels.k >&2 || exit 1
+
+"$CXX" -O2 -o "$TMP/harness" bench/runtime/harness.cc "$TMP"/*.o || exit 1
+"$TMP/harness"
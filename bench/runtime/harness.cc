@@ -0,0 +1,111 @@
+// Misura il tempo di esecuzione dei kernel compilati da kfe e stampa i
+// risultati su stdout nel formato JSON di Google Benchmark (context +
+// benchmarks), così che possano essere confrontati con bench/compare.py o
+// con gli strumenti di Google Benchmark.
+//
+// Ogni kernel viene ripetuto raddoppiando le iterazioni finché una
+// misura non dura almeno MinTime; il tempo riportato è per iterazione.
+
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <vector>
+
+extern "C"
+{
+    // kaleidoscope-examples
+    double fib(double);
+    double arr();
+    double add(double, double);
+    double mul(double, double);
+    double divide(double, double);
+    double lt(double, double);
+    double neg(double);
+    double forexpr(double);
+
+    // bench/runtime/kernels.k
+    double axpy_loop(double*, double*, double);
+    double dot_loop(double*, double*, double);
+    double dot_builtin(double*, double*, double);
+    double sum_builtin(double*, double);
+    double stencil(double);
+}
+
+namespace
+{
+
+constexpr double MinTime = 0.2; // secondi
+
+// Impedisce al compilatore di eliminare il calcolo del risultato
+volatile double sink;
+
+struct Result
+{
+    std::string name;
+    long iterations;
+    double realNs;
+    double cpuNs;
+};
+
+Result measure(const std::string& name, const std::function<double()>& kernel)
+{
+    for (long iterations = 1;; iterations *= 2)
+    {
+        auto realStart = std::chrono::steady_clock::now();
+        std::clock_t cpuStart = std::clock();
+
+        for (long i = 0; i < iterations; ++i)
+            sink = kernel();
+
+        double cpu = double(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+        double real = std::chrono::duration<double>(std::chrono::steady_clock::now() - realStart).count();
+
+        if (real >= MinTime || iterations >= (1L << 40))
+            return {name, iterations, real * 1e9 / iterations, cpu * 1e9 / iterations};
+    }
+}
+
+} // namespace
+
+int main()
+{
+    std::vector<double> x(4096), y(4096);
+    for (size_t i = 0; i < x.size(); ++i)
+    {
+        x[i] = 0.5 * double(i % 17);
+        y[i] = 1.0 / double(i + 1);
+    }
+    double n = double(x.size());
+    // Gli operandi passano da una volatile: le chiamate non vengono ripiegate
+    volatile double a = 3.5, b = 1.25;
+
+    std::vector<Result> results = {
+        measure("fib/90", [] { return fib(90); }),
+        measure("arr", [] { return arr(); }),
+        measure("operators/add", [&] { return add(a, b); }),
+        measure("operators/mul", [&] { return mul(a, b); }),
+        measure("operators/divide", [&] { return divide(a, b); }),
+        measure("operators/lt", [&] { return lt(a, b); }),
+        measure("operators/neg", [&] { return neg(a); }),
+        measure("forexpr/1000", [] { return forexpr(1000); }),
+        measure("axpy_loop/4096", [&] { return axpy_loop(x.data(), y.data(), n); }),
+        measure("dot_loop/4096", [&] { return dot_loop(x.data(), y.data(), n); }),
+        measure("dot_builtin/4096", [&] { return dot_builtin(x.data(), y.data(), n); }),
+        measure("sum_builtin/4096", [&] { return sum_builtin(x.data(), n); }),
+        measure("stencil/1024", [&] { return stencil(a); }),
+    };
+
+    std::printf("{\n  \"context\": {\"executable\": \"bench/runtime/harness\", \"library_build_type\": \"release\"},\n");
+    std::printf("  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const Result& r = results[i];
+        std::printf("    {\"name\": \"%s\", \"run_type\": \"iteration\", \"iterations\": %ld, \"real_time\": %.3f, \"cpu_time\": %.3f, \"time_unit\": \"ns\"}%s\n",
+                    r.name.c_str(), r.iterations, r.realNs, r.cpuNs, i + 1 < results.size() ? "," : "");
+    }
+    std::printf("  ]\n}\n");
+
+    return 0;
+}
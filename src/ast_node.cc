@@ -1,7 +1,12 @@
 #include "ast_node.hh"
+#include "builtins.hh"
 #include "driver.hh"
+#include "integer_inference.hh"
 #include <llvm/ADT/APFloat.h>
 #include <llvm/ADT/APInt.h>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/ADT/SmallVector.h>
 #include <llvm/IR/BasicBlock.h>
 #include <llvm/IR/Constant.h>
 #include <llvm/IR/Constants.h>
@@ -11,19 +16,36 @@
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/IRBuilderFolder.h>
 #include <llvm/IR/Instructions.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/Metadata.h>
 #include <llvm/IR/Type.h>
 #include <llvm/IR/Value.h>
 #include <llvm/Support/Alignment.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <optional>
 #include <stdexcept>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
-static llvm::AllocaInst* CreateEntryBlockAlloca(const driver& drv, llvm::Function* function, const std::string& varName)
+static llvm::AllocaInst* CreateEntryBlockAlloca(const driver& drv, llvm::Function* function, llvm::StringRef varName, llvm::Type* type = nullptr)
 {
     llvm::IRBuilder<> tmpBuilder(&function->getEntryBlock(), function->getEntryBlock().begin());
 
-    return tmpBuilder.CreateAlloca(llvm::Type::getDoubleTy(*drv.context), 0, varName.c_str());
+    return tmpBuilder.CreateAlloca(type ? type : llvm::Type::getDoubleTy(*drv.context), 0, varName);
+}
+
+static llvm::PointerType* pointerType(const driver& drv)
+{
+    return llvm::PointerType::get(*drv.context, 0);
+}
+
+// Tipo del binding di un parametro array: la lunghezza non è nota
+static llvm::ArrayType* unsizedArrayType(const driver& drv)
+{
+    return llvm::ArrayType::get(llvm::Type::getDoubleTy(*drv.context), 0);
 }
 
 llvm::Value* LogErrorV(const std::string Str)
@@ -32,18 +54,132 @@ llvm::Value* LogErrorV(const std::string Str)
     return nullptr;
 }
 
+// Un'espressione è pura se valutarla non ha altro effetto che produrne
+// il valore, quindi può essere scartata se il valore non è usato
+bool isPure(ExprAST* expr)
+{
+    if (!expr)
+        return true;
+
+    switch (expr->getKind())
+    {
+        case RootAST::AK_Number:
+        case RootAST::AK_Variable:
+            return true;
+        case RootAST::AK_Binary:
+        {
+            auto* binary = llvm::cast<BinaryExprAST>(expr);
+            return binary->getOp() != Operator::ASSIGN && isPure(binary->getLHS()) && isPure(binary->getRHS());
+        }
+        case RootAST::AK_Unary:
+            return isPure(llvm::cast<UnaryExprAST>(expr)->getOperand());
+        case RootAST::AK_If:
+        {
+            auto* ifExpr = llvm::cast<IfExprNode>(expr);
+            return isPure(ifExpr->getCondition()) && isPure(ifExpr->getThen()) && isPure(ifExpr->getElse());
+        }
+        case RootAST::AK_ArrayIndexing:
+            return isPure(llvm::cast<ArrayIndexingExprAST>(expr)->getIndex());
+        default:
+            // Chiamate, cicli e blocchi var possono scrivere in memoria o non terminare
+            return false;
+    }
+}
+
+/************************* Integer values *************************/
+// Intervallo intero di un'espressione con i binding correnti, dove le
+// variabili tenute in un i64 (vedi inferIntegers) contengono interi
+static std::optional<IntegerRange> currentIntegerRange(driver& drv, ExprAST* expr)
+{
+    return integerRange(expr, [&drv](VariableExprAST* variable) {
+        llvm::Type* type = drv.symbolTable.lookup(variable->getName()).type;
+        return type && type->isIntegerTy();
+    });
+}
+
+// Valore i64 di un'espressione accettata da currentIntegerRange. Ogni
+// passo è esatto anche nell'aritmetica double, quindi il risultato è lo
+// stesso numero, e l'intervallo esclude l'overflow con segno.
+static llvm::Value* codegenInteger(driver& drv, ExprAST* expr)
+{
+    llvm::IRBuilder<>& builder = *drv.builder;
+
+    switch (expr->getKind())
+    {
+        case RootAST::AK_Number:
+            return builder.getInt64(int64_t(llvm::cast<NumberExprAST>(expr)->getVal()));
+        case RootAST::AK_Variable:
+        {
+            Symbol name = llvm::cast<VariableExprAST>(expr)->getName();
+            Binding binding = drv.symbolTable.lookup(name);
+            return builder.CreateLoad(binding.type, binding.address, drv.interner.name(name));
+        }
+        case RootAST::AK_Unary:
+            return builder.CreateNSWNeg(codegenInteger(drv, llvm::cast<UnaryExprAST>(expr)->getOperand()), "negreg");
+        case RootAST::AK_Binary:
+        {
+            auto* binary = llvm::cast<BinaryExprAST>(expr);
+            llvm::Value* l = codegenInteger(drv, binary->getLHS());
+            llvm::Value* r = codegenInteger(drv, binary->getRHS());
+
+            switch (binary->getOp())
+            {
+                case Operator::PLUS:
+                    return builder.CreateNSWAdd(l, r, "addregister");
+                case Operator::MINUS:
+                    return builder.CreateNSWSub(l, r, "subregister");
+                default:
+                    return builder.CreateNSWMul(l, r, "mulregister");
+            }
+        }
+        default:
+            llvm_unreachable("not an integer expression");
+    }
+}
+
+// Gli interi non sono mai unordered, quindi i predicati con segno
+// equivalgono a quelli fcmp unordered usati per i double
+static llvm::CmpInst::Predicate integerPredicate(Operator op)
+{
+    switch (op)
+    {
+        case Operator::LESS_THAN:
+            return llvm::CmpInst::ICMP_SLT;
+        case Operator::LESS_EQUAL:
+            return llvm::CmpInst::ICMP_SLE;
+        case Operator::GREATER_THAN:
+            return llvm::CmpInst::ICMP_SGT;
+        case Operator::GREATER_EQUAL:
+            return llvm::CmpInst::ICMP_SGE;
+        case Operator::EQUAL:
+            return llvm::CmpInst::ICMP_EQ;
+        default:
+            return llvm::CmpInst::ICMP_NE;
+    }
+}
+
 /********************** Handle Top Expressions ********************/
 llvm::Value* TopExpression(ExprAST* E, driver& drv)
 {
     // Crea una funzione anonima anonima il cui body è un'espressione top-level
     // viene "racchiusa" un'espressione top-level
     E->toggle(); // Evita la doppia emissione del prototipo
-    PrototypeAST* Proto = new PrototypeAST(
-        "__espr_anonima" + std::to_string(++drv.Cnt), std::vector<std::string>());
+    PrototypeAST* Proto = drv.make<PrototypeAST>(
+        drv.interner.intern("__espr_anonima" + std::to_string(++drv.Cnt)), llvm::ArrayRef<Param>());
     Proto->noemit();
-    FunctionAST* F = new FunctionAST(std::move(Proto), E);
+    FunctionAST* F = drv.make<FunctionAST>(Proto, E);
     auto* FnIR = F->codegen(drv);
-    FnIR->eraseFromParent();
+    if (!FnIR)
+        return nullptr;
+    if (drv.run_mode)
+    {
+        // In modalità --run la funzione viene eseguita dopo la compilazione del modulo
+        drv.topLevelExprs.push_back(std::string(FnIR->getName()));
+    }
+    else
+    {
+        FnIR->eraseFromParent();
+    }
     return nullptr;
 };
 
@@ -54,170 +190,130 @@ void ExprAST::toggle() { top = top ? false : true; };
 
 bool ExprAST::gettop() { return top; };
 
-/************************* Sequence tree **************************/
-SeqAST::SeqAST(RootAST* first, RootAST* continuation) :
-    first(first), continuation(continuation){};
-
-void SeqAST::visit()
+llvm::Value* ExprAST::codegen(driver& drv)
 {
-    if (first != nullptr)
-    {
-        first->visit();
-    }
-    else
-    {
-        if (continuation == nullptr)
-        {
-            return;
-        };
-    };
-    std::cout << ";";
-    continuation->visit();
-};
+    if (gettop())
+        return TopExpression(this, drv);
+    return codegenValue(drv);
+}
 
-llvm::Value* SeqAST::codegen(driver& drv)
+// Solo variabili ed elementi di array indicano una locazione di memoria
+llvm::Value* ExprAST::codegenAddress(driver&)
 {
-    if (first != nullptr)
-    {
-        first->codegen(drv);
-    }
-    else
-    {
-        if (continuation == nullptr)
-            return nullptr;
-    }
-    continuation->codegen(drv);
-    return nullptr;
-};
+    throw std::runtime_error("Errore nel calcolo dell'indirizzo del left value.");
+}
 
 /********************* Number Expression Tree *********************/
 NumberExprAST::NumberExprAST(double Val) :
-    Val(Val) { top = false; };
-void NumberExprAST::visit() { std::cout << Val << " "; };
+    ExprAST(AK_Number), Val(Val) {};
+void NumberExprAST::visit(const driver&) { std::cout << Val << " "; };
 
-llvm::Value* NumberExprAST::codegen(driver& drv)
+llvm::Value* NumberExprAST::codegenValue(driver& drv)
 {
-    if (gettop())
-        return TopExpression(this, drv);
-    else
-        return llvm::ConstantFP::get(*drv.context, llvm::APFloat(Val));
+    return llvm::ConstantFP::get(*drv.context, llvm::APFloat(Val));
 };
 
 /****************** Variable Expression TreeAST *******************/
-VariableExprAST::VariableExprAST(std::string& varName) :
-    varName(varName)
-{
-    top = false;
-};
+VariableExprAST::VariableExprAST(Symbol varName) :
+    ExprAST(AK_Variable), varName(varName) {};
 
-const std::string& VariableExprAST::getName() const
+Symbol VariableExprAST::getName() const
 {
     return varName;
 }
 
-void VariableExprAST::visit()
+void VariableExprAST::visit(const driver& drv)
 {
-    std::cout << varName << " ";
+    std::cout << drv.interner.name(varName).str() << " ";
 }
 
-llvm::Value* VariableExprAST::codegen(driver& drv)
+llvm::Value* VariableExprAST::codegenAddress(driver& drv)
 {
-    auto* alloca = drv.symbolTable[varName];
+    Binding binding = drv.symbolTable.lookup(varName);
+
+    if (!binding.address)
+    {
+        throw std::runtime_error("Accesso ad una variabile non dichiarata: " + drv.interner.name(varName).str());
+    }
 
-    if (!alloca)
+    if (binding.type->isArrayTy())
     {
-        throw std::runtime_error("Accesso ad una variabile non dichiarata: " + varName);
+        throw std::runtime_error("L'array " + drv.interner.name(varName).str() + " può essere usato solo con un indice.");
     }
 
-    return drv.builder->CreateLoad(alloca->getAllocatedType(), alloca, this->varName);
+    return binding.address;
 }
 
-/******************** Binary Expression Tree **********************/
-BinaryExprAST::BinaryExprAST(Operator Op, ExprAST* LHS, ExprAST* RHS) :
-    Op(Op), LHS(LHS), RHS(RHS)
+llvm::Value* VariableExprAST::codegenValue(driver& drv)
 {
-    top = false;
+    llvm::Value* address = codegenAddress(drv);
+    llvm::Type* type = drv.symbolTable.lookup(varName).type;
+    llvm::Value* value = drv.builder->CreateLoad(type, address, drv.interner.name(varName));
+
+    // Una variabile intera diventa double dove il suo valore è usato come tale
+    if (type->isIntegerTy())
+        value = drv.builder->CreateSIToFP(value, llvm::Type::getDoubleTy(*drv.context));
+    return value;
 }
 
-void BinaryExprAST::visit()
+/******************** Binary Expression Tree **********************/
+BinaryExprAST::BinaryExprAST(Operator Op, ExprAST* LHS, ExprAST* RHS) :
+    ExprAST(AK_Binary), Op(Op), LHS(LHS), RHS(RHS) {}
+
+void BinaryExprAST::visit(const driver& drv)
 {
     std::cout << "(" << Op << " ";
-    LHS->visit();
+    LHS->visit(drv);
     if (RHS != nullptr)
-        RHS->visit();
+        RHS->visit(drv);
     std::cout << ")";
 }
 
-llvm::Value* BinaryExprAST::codegen(driver& drv)
+llvm::Value* BinaryExprAST::codegenValue(driver& drv)
 {
     if (Op == Operator::ASSIGN)
     {
-        llvm::Value* rhsValue = nullptr;
-        llvm::Value* lhsAddress = nullptr;
-
-        if (ArrayIndexingExprAST* arrayExpr = dynamic_cast<ArrayIndexingExprAST*>(this->RHS))
+        // Una variabile intera memorizza un i64, e inferIntegers ha
+        // dimostrato che il lato destro lo è; l'assegnamento lo restituisce
+        // come double
+        if (auto* variable = llvm::dyn_cast<VariableExprAST>(LHS))
         {
-            llvm::Value* elementAddress = arrayExpr->codegen(drv);
+            llvm::Type* type = drv.symbolTable.lookup(variable->getName()).type;
 
-            rhsValue = drv.builder->CreateLoad(llvm::Type::getDoubleTy(*drv.context), elementAddress);
-        }
-        else
-        {
-            rhsValue = this->RHS->codegen(drv);
+            if (type && type->isIntegerTy())
+            {
+                llvm::Value* rhsValue = codegenInteger(drv, RHS);
+                drv.builder->CreateStore(rhsValue, LHS->codegenAddress(drv));
+                return drv.builder->CreateSIToFP(rhsValue, llvm::Type::getDoubleTy(*drv.context));
+            }
         }
 
-        if (VariableExprAST* variableExpr = dynamic_cast<VariableExprAST*>(this->LHS))
-        {
-            lhsAddress = drv.symbolTable[variableExpr->getName()];
-        }
-        else if (ArrayIndexingExprAST* arrayExpr = dynamic_cast<ArrayIndexingExprAST*>(this->LHS))
-        {
-            lhsAddress = arrayExpr->codegen(drv);
-        }
+        // Il lato destro è un valore, il lato sinistro una locazione
+        llvm::Value* rhsValue = RHS->codegenValue(drv);
 
         if (!rhsValue)
         {
             throw std::runtime_error("Errore nel calcolo del right value.");
         }
 
-        if (!lhsAddress)
-        {
-            throw std::runtime_error("Errore nel calcolo dell'indirizzo del left value.");
-        }
+        llvm::Value* lhsAddress = LHS->codegenAddress(drv);
 
         drv.builder->CreateStore(rhsValue, lhsAddress);
 
         return rhsValue;
     }
-
-    if (gettop())
+    else if (isComparison(Op) && currentIntegerRange(drv, LHS) && currentIntegerRange(drv, RHS))
     {
-        return TopExpression(this, drv);
+        // Gli interi sono confrontati senza convertirli in double
+        llvm::Value* L = codegenInteger(drv, LHS);
+        llvm::Value* R = codegenInteger(drv, RHS);
+        L = drv.builder->CreateICmp(integerPredicate(Op), L, R, "cmptmp");
+        return drv.builder->CreateUIToFP(L, llvm::Type::getDoubleTy(*drv.context), "booltmp");
     }
     else
     {
-        llvm::Value* L = nullptr;
-        llvm::Value* R = nullptr;
-
-        if (ArrayIndexingExprAST* lhsArray = dynamic_cast<ArrayIndexingExprAST*>(LHS))
-        {
-            auto* gep = lhsArray->codegen(drv);
-            L = drv.builder->CreateLoad(llvm::Type::getDoubleTy(*drv.context), gep);
-        }
-        else
-        {
-            L = LHS->codegen(drv);
-        }
-
-        if (ArrayIndexingExprAST* rhsArray = dynamic_cast<ArrayIndexingExprAST*>(RHS))
-        {
-            auto* gep = rhsArray->codegen(drv);
-            R = drv.builder->CreateLoad(llvm::Type::getDoubleTy(*drv.context), gep);
-        }
-        else
-        {
-            R = RHS->codegen(drv);
-        }
+        llvm::Value* L = LHS->codegenValue(drv);
+        llvm::Value* R = RHS->codegenValue(drv);
 
         if (!L || !R)
             return nullptr;
@@ -258,23 +354,11 @@ llvm::Value* BinaryExprAST::codegen(driver& drv)
 }
 
 UnaryExprAST::UnaryExprAST(const Operator& op, ExprAST* operand) :
-    op(op), operand(operand) {}
+    ExprAST(AK_Unary), op(op), operand(operand) {}
 
-llvm::Value* UnaryExprAST::codegen(driver& drv)
+llvm::Value* UnaryExprAST::codegenValue(driver& drv)
 {
-    llvm::Value* exprValue = nullptr;
-
-    if (ArrayIndexingExprAST* arrayExpr =
-            dynamic_cast<ArrayIndexingExprAST*>(operand))
-    {
-        auto* elementAddress = arrayExpr->codegen(drv);
-
-        exprValue = drv.builder->CreateLoad(llvm::Type::getDoubleTy(*drv.context), elementAddress);
-    }
-    else
-    {
-        exprValue = operand->codegen(drv);
-    }
+    llvm::Value* exprValue = operand->codegenValue(drv);
 
     switch (op)
     {
@@ -286,64 +370,84 @@ llvm::Value* UnaryExprAST::codegen(driver& drv)
 }
 
 /********************* Call Expression Tree ***********************/
-CallExprAST::CallExprAST(std::string Callee, std::vector<ExprAST*> Args) :
-    Callee(Callee), Args(std::move(Args))
-{
-    top = false;
-}
+CallExprAST::CallExprAST(Symbol Callee, llvm::MutableArrayRef<ExprAST*> Args) :
+    ExprAST(AK_Call), Callee(Callee), Args(Args) {}
 
-void CallExprAST::visit()
+void CallExprAST::visit(const driver& drv)
 {
-    std::cout << Callee << "( ";
+    std::cout << drv.interner.name(Callee).str() << "( ";
     for (ExprAST* arg : Args)
     {
-        arg->visit();
+        arg->visit(drv);
     };
     std::cout << ')';
 };
 
-llvm::Value* CallExprAST::codegen(driver& drv)
+llvm::Value* CallExprAST::codegenValue(driver& drv)
 {
-    if (gettop())
-    {
-        return TopExpression(this, drv);
-    }
-    else
+    // sum, dot, min, max e axpy sono generate in linea, se non ridefinite
+    if (isBuiltinCall(drv, this))
+        return emitBuiltinCall(drv, this);
+
+    // Cerchiamo la funzione nell'ambiente globale
+    llvm::Function* CalleeF = drv.getFunction(drv.interner.name(Callee));
+    if (!CalleeF)
+        return LogErrorV("Funzione non definita");
+    // Controlliamo che gli argomenti coincidano in numero coi parametri
+    if (CalleeF->arg_size() != Args.size())
+        return LogErrorV("Numero di argomenti non corretto");
+    std::vector<llvm::Value*> ArgsV;
+    for (unsigned i = 0; i < Args.size(); ++i)
     {
-        // Cerchiamo la funzione nell'ambiente globale
-        llvm::Function* CalleeF = drv.module->getFunction(Callee);
-        if (!CalleeF)
-            return LogErrorV("Funzione non definita");
-        // Controlliamo che gli argomenti coincidano in numero coi parametri
-        if (CalleeF->arg_size() != Args.size())
-            return LogErrorV("Numero di argomenti non corretto");
-        std::vector<llvm::Value*> ArgsV;
-        for (auto arg : Args)
+        if (CalleeF->getArg(i)->getType()->isPointerTy())
         {
-            ArgsV.push_back(arg->codegen(drv));
-            if (!ArgsV.back())
-                return nullptr;
+            // Parametro array: passa la memoria del chiamante senza copiarla
+            Binding binding = arrayArgument(drv, Args[i]);
+            if (!binding.address)
+                throw std::runtime_error("L'argomento " + std::to_string(i + 1) + " di " + drv.interner.name(Callee).str() + " deve essere un array");
+            ArgsV.push_back(binding.address);
+            continue;
         }
-        return drv.builder->CreateCall(CalleeF, ArgsV, "calltmp");
+        ArgsV.push_back(Args[i]->codegenValue(drv));
+        if (!ArgsV.back())
+            return nullptr;
     }
+    llvm::CallInst* call = drv.builder->CreateCall(CalleeF, ArgsV, "calltmp");
+    call->setCallingConv(CalleeF->getCallingConv());
+
+    // Una chiamata in coda non ha più bisogno del frame del chiamante, a
+    // meno che riceva uno dei suoi array locali o che la funzione ne abbia
+    // passato uno a un'altra chiamata, che potrebbe averlo conservato
+    bool frameFree = !drv.localArrayEscapes &&
+                     llvm::all_of(ArgsV, [](llvm::Value* arg) { return !arg->getType()->isPointerTy() || llvm::isa<llvm::Argument>(arg); });
+    if (tail != TailCall::None && frameFree)
+    {
+        // musttail richiede anche prototipo e convenzione di chiamata del chiamante
+        llvm::Function* caller = drv.builder->GetInsertBlock()->getParent();
+        bool mustTail = tail == TailCall::MustTail && CalleeF->getFunctionType() == caller->getFunctionType() &&
+                        CalleeF->getCallingConv() == caller->getCallingConv();
+        call->setTailCallKind(mustTail ? llvm::CallInst::TCK_MustTail : llvm::CallInst::TCK_Tail);
+        ++(mustTail ? drv.mustTailCalls : drv.tailCalls);
+    }
+    return call;
 }
 
 /************************* Prototype Tree *************************/
-PrototypeAST::PrototypeAST(std::string Name, std::vector<std::string> Args) :
-    Name(Name), Args(std::move(Args))
+PrototypeAST::PrototypeAST(Symbol Name, llvm::ArrayRef<Param> Args) :
+    RootAST(AK_Prototype), Name(Name), Args(Args)
 {
     emit = true;
 }
 
-const std::string& PrototypeAST::getName() const { return Name; };
-const std::vector<std::string>& PrototypeAST::getArgs() const { return Args; };
+Symbol PrototypeAST::getName() const { return Name; };
+llvm::ArrayRef<Param> PrototypeAST::getArgs() const { return Args; };
 
-void PrototypeAST::visit()
+void PrototypeAST::visit(const driver& drv)
 {
-    std::cout << "extern " << getName() << "( ";
+    std::cout << "extern " << drv.interner.name(getName()).str() << "( ";
     for (auto it = getArgs().begin(); it != getArgs().end(); ++it)
     {
-        std::cout << *it << ' ';
+        std::cout << drv.interner.name(it->name).str() << (it->array ? "[] " : " ");
     };
     std::cout << ')';
 }
@@ -355,18 +459,21 @@ bool PrototypeAST::emitp() { return emit; };
 llvm::Function* PrototypeAST::codegen(driver& drv)
 {
     // Costruisce una struttura double(double,...,double) che descrive
-    // tipo di ritorno e tipo dei parametri (in Kaleidoscope solo double)
-    std::vector<llvm::Type*> Doubles(Args.size(), llvm::Type::getDoubleTy(*drv.context));
-    llvm::FunctionType* FT = llvm::FunctionType::get(llvm::Type::getDoubleTy(*drv.context), Doubles, false);
-    llvm::Function* F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, Name, *drv.module);
+    // tipo di ritorno e tipo dei parametri: double, oppure double* per i
+    // parametri array
+    std::vector<llvm::Type*> ParamTypes;
+    for (const Param& param : Args)
+        ParamTypes.push_back(param.array ? static_cast<llvm::Type*>(pointerType(drv)) : llvm::Type::getDoubleTy(*drv.context));
+    llvm::FunctionType* FT = llvm::FunctionType::get(llvm::Type::getDoubleTy(*drv.context), ParamTypes, false);
+    llvm::Function* F = llvm::Function::Create(FT, llvm::Function::ExternalLinkage, drv.interner.name(Name), *drv.module);
 
     // Attribuiamo agli argomenti il nome dei parametri formali specificati dal
     // programmatore
     unsigned Idx = 0;
     for (auto& Arg : F->args())
-        Arg.setName(Args[Idx++]);
+        Arg.setName(drv.interner.name(Args[Idx++].name));
 
-    if (emitp())
+    if (emitp() && drv.print_ir)
     { // emitp() restituisce true se e solo se il prototipo è
       // definito extern
         F->print(llvm::errs());
@@ -377,8 +484,8 @@ llvm::Function* PrototypeAST::codegen(driver& drv)
 }
 
 /************************* Function Tree **************************/
-FunctionAST::FunctionAST(PrototypeAST* Proto, ExprAST* Body) :
-    Proto(Proto), Body(Body)
+FunctionAST::FunctionAST(PrototypeAST* Proto, ExprAST* Body, bool fast) :
+    RootAST(AK_Function), Proto(Proto), Body(Body), fast(fast)
 {
     if (Body == nullptr)
         external = true;
@@ -386,24 +493,111 @@ FunctionAST::FunctionAST(PrototypeAST* Proto, ExprAST* Body) :
         external = false;
 };
 
-void FunctionAST::visit()
+void FunctionAST::visit(const driver& drv)
 {
-    std::cout << Proto->getName() << "( ";
+    if (fast)
+        std::cout << "fast ";
+    std::cout << drv.interner.name(Proto->getName()).str() << "( ";
     for (auto it = Proto->getArgs().begin(); it != Proto->getArgs().end(); ++it)
     {
-        std::cout << *it << ' ';
+        std::cout << drv.interner.name(it->name).str() << (it->array ? "[] " : " ");
     };
     std::cout << ')';
-    Body->visit();
+    Body->visit(drv);
+}
+
+// Attributi stringa corrispondenti ai flag fast-math, per le parti del
+// generatore di codice che non guardano i flag delle istruzioni
+static void addFastMathAttributes(llvm::Function* function, llvm::FastMathFlags flags)
+{
+    if (flags.noNaNs())
+        function->addFnAttr("no-nans-fp-math", "true");
+    if (flags.noInfs())
+        function->addFnAttr("no-infs-fp-math", "true");
+    if (flags.noSignedZeros())
+        function->addFnAttr("no-signed-zeros-fp-math", "true");
+    if (flags.approxFunc())
+        function->addFnAttr("approx-func-fp-math", "true");
+    if (flags.isFast())
+        function->addFnAttr("unsafe-fp-math", "true");
+}
+
+// Vero se il sottoalbero contiene una chiamata che riceve name come
+// argomento. I builtin leggono e scrivono solo gli elementi, quindi non
+// contano.
+static bool passedToCall(driver& drv, RootAST* node, Symbol name)
+{
+    if (auto* call = llvm::dyn_cast<CallExprAST>(node); call && !isBuiltinCall(drv, call))
+        for (ExprAST* arg : call->getArgs())
+        {
+            auto* variable = llvm::dyn_cast<VariableExprAST>(arg);
+            if (variable && variable->getName() == name)
+                return true;
+        }
+
+    bool found = false;
+    forEachChild(node, [&](ExprAST*& child) { found = found || passedToCall(drv, child, name); });
+    return found;
+}
+
+// Vero se un array dichiarato in un blocco var del sottoalbero viene
+// passato a una chiamata che non sia un builtin
+static bool localArrayPassed(driver& drv, RootAST* node)
+{
+    if (auto* block = llvm::dyn_cast<VarExprAST>(node))
+        for (auto& [name, init] : block->getVarNames())
+            if (llvm::isa_and_nonnull<ArrayInitExprAST>(init) && passedToCall(drv, block, name))
+                return true;
+
+    bool found = false;
+    forEachChild(node, [&](ExprAST*& child) { found = found || localArrayPassed(drv, child); });
+    return found;
+}
+
+// I builtin toccano solo gli array che ricevono, quindi non contano
+static bool containsCall(driver& drv, RootAST* node)
+{
+    if (auto* call = llvm::dyn_cast<CallExprAST>(node); call && !isBuiltinCall(drv, call))
+        return true;
+
+    bool found = false;
+    forEachChild(node, [&](ExprAST*& child) { found = found || containsCall(drv, child); });
+    return found;
+}
+
+// I parametri array passano solo per indicizzazioni e argomenti di
+// chiamate, quindi un buffer che il corpo non passa mai a una chiamata non
+// può essere catturato. Senza variabili globali, un solo parametro array
+// può sovrapporsi solo a memoria che una funzione esterna raggiunge da
+// sola, quindi noalias vale se il corpo non fa chiamate; con più array il
+// chiamante può passare due volte lo stesso buffer, cosa che solo
+// -fassume-noalias esclude.
+static void addArrayParamAttributes(driver& drv, PrototypeAST* proto, ExprAST* body, llvm::Function* function)
+{
+    unsigned arrays = llvm::count_if(proto->getArgs(), [](const Param& param) { return param.array; });
+    bool noalias = drv.assumeNoalias || (arrays == 1 && !containsCall(drv, body));
+
+    for (unsigned i = 0; i < proto->getArgs().size(); ++i)
+    {
+        const Param& param = proto->getArgs()[i];
+        if (!param.array)
+            continue;
+
+        if (!passedToCall(drv, body, param.name))
+            function->addParamAttr(i, llvm::Attribute::NoCapture);
+        if (noalias)
+            function->addParamAttr(i, llvm::Attribute::NoAlias);
+    }
 }
 
 llvm::Function* FunctionAST::codegen(driver& drv)
 {
     // Verifica che non esiste già, nel contesto, una funzione con lo stesso nome
-    std::string name = Proto->getName();
+    std::string name = drv.interner.name(Proto->getName()).str();
     llvm::Function* TheFunction = drv.module->getFunction(name);
-    // E se non esiste prova a definirla
-    if (TheFunction)
+    // E se non esiste prova a definirla. Con --run vale anche per le
+    // funzioni definite nei file precedenti, già passate al JIT
+    if (TheFunction || drv.knownFunctions.lookup(name).defined)
     {
         LogErrorV("Funzione " + name + " già definita");
         return nullptr;
@@ -417,18 +611,41 @@ llvm::Function* FunctionAST::codegen(driver& drv)
     llvm::BasicBlock* BB = llvm::BasicBlock::Create(*drv.context, "entry", TheFunction);
     drv.builder->SetInsertPoint(BB);
 
-    // Registra gli argomenti nella symbol table
-    drv.symbolTable.clear();
+    // Le operazioni in virgola mobile della funzione portano i flag
+    // fast-math della riga di comando, oppure tutti con "def fast"
+    llvm::FastMathFlags fastMath = fast ? llvm::FastMathFlags::getFast() : drv.fastMath;
+    llvm::IRBuilder<>::FastMathFlagGuard fastMathGuard(*drv.builder);
+    drv.builder->setFastMathFlags(fastMath);
+    addFastMathAttributes(TheFunction, fastMath);
+
+    // Registra gli argomenti nella symbol table, in uno scope che viene
+    // chiuso all'uscita dalla funzione
+    drv.symbolTable.reset();
+    drv.checkedIndices.clear();
+    drv.localArrayEscapes = localArrayPassed(drv, Body);
+    SymbolTable::Scope scope(drv.symbolTable);
+    unsigned Idx = 0;
     for (auto& Arg : TheFunction->args())
     {
-        llvm::AllocaInst* Alloca = CreateEntryBlockAlloca(drv, TheFunction, std::string(Arg.getName()));
+        const Param& param = Proto->getArgs()[Idx++];
+
+        if (param.array)
+        {
+            // Il buffer del chiamante viene usato sul posto; la sua dimensione non è nota
+            drv.symbolTable.bind(param.name, {&Arg, unsizedArrayType(drv)});
+            continue;
+        }
+
+        llvm::AllocaInst* Alloca = CreateEntryBlockAlloca(drv, TheFunction, Arg.getName());
 
         drv.builder->CreateStore(&Arg, Alloca);
 
-        drv.symbolTable[std::string(Arg.getName())] = Alloca;
+        drv.symbolTable.bind(param.name, {Alloca, Alloca->getAllocatedType()});
     }
 
-    if (llvm::Value* RetVal = Body->codegen(drv))
+    addArrayParamAttributes(drv, Proto, Body, TheFunction);
+
+    if (llvm::Value* RetVal = Body->codegenValue(drv))
     {
         // Termina la creazione del codice corrispondente alla funzione
         drv.builder->CreateRet(RetVal);
@@ -436,8 +653,11 @@ llvm::Function* FunctionAST::codegen(driver& drv)
         // Effettua la validazione del codice e un controllo di consistenza
         verifyFunction(*TheFunction);
 
-        TheFunction->print(llvm::errs());
-        fprintf(stderr, "\n");
+        if (drv.print_ir)
+        {
+            TheFunction->print(llvm::errs());
+            fprintf(stderr, "\n");
+        }
         return TheFunction;
     }
 
@@ -446,34 +666,35 @@ llvm::Function* FunctionAST::codegen(driver& drv)
     return nullptr;
 };
 
-IfExprNode::IfExprNode(ExprAST* condition, ExprAST* thenExpr, ExprAST* elseExpr)
+IfExprNode::IfExprNode(ExprAST* condition, ExprAST* thenExpr, ExprAST* elseExpr) :
+    ExprAST(AK_If)
 {
     this->conditionExpr = condition;
     this->thenExpr = thenExpr;
     this->elseExpr = elseExpr;
 }
 
-void IfExprNode::visit()
+void IfExprNode::visit(const driver& drv)
 {
     std::cout << "(";
-    conditionExpr->visit();
+    conditionExpr->visit(drv);
 
     std::cout << " then ";
 
-    thenExpr->visit();
+    thenExpr->visit(drv);
 
     if (elseExpr)
     {
         std::cout << " else ";
-        elseExpr->visit();
+        elseExpr->visit(drv);
     }
 
     std::cout << ")";
 }
 
-llvm::Value* IfExprNode::codegen(driver& drv)
+llvm::Value* IfExprNode::codegenValue(driver& drv)
 {
-    auto* conditionValue = conditionExpr->codegen(drv);
+    auto* conditionValue = conditionExpr->codegenValue(drv);
 
     conditionValue = drv.builder->CreateFCmpONE(conditionValue, llvm::ConstantFP::get(*drv.context, llvm::APFloat(0.0)), "iftest");
 
@@ -489,14 +710,14 @@ llvm::Value* IfExprNode::codegen(driver& drv)
 
         drv.builder->SetInsertPoint(thenBlock);
 
-        llvm::Value* thenV = thenExpr->codegen(drv);
+        llvm::Value* thenV = thenExpr->codegenValue(drv);
         drv.builder->CreateBr(mergeBB);
 
         thenBlock = drv.builder->GetInsertBlock();
         currentFunction->insert(currentFunction->end(), elseBlock);
         drv.builder->SetInsertPoint(elseBlock);
 
-        llvm::Value* elseV = elseExpr->codegen(drv);
+        llvm::Value* elseV = elseExpr->codegenValue(drv);
         drv.builder->CreateBr(mergeBB);
 
         elseBlock = drv.builder->GetInsertBlock();
@@ -518,7 +739,7 @@ llvm::Value* IfExprNode::codegen(driver& drv)
 
         drv.builder->SetInsertPoint(thenBlock);
 
-        auto* thenValue = thenExpr->codegen(drv);
+        auto* thenValue = thenExpr->codegenValue(drv);
         drv.builder->CreateBr(afterThenBlock);
 
         currentFunction->insert(currentFunction->end(), afterThenBlock);
@@ -528,71 +749,678 @@ llvm::Value* IfExprNode::codegen(driver& drv)
     }
 }
 
-ForExprAST::ForExprAST(const std::string& varName, ExprAST* start, ExprAST* end, ExprAST* step, ExprAST* body) :
-    varName(varName), start(start), end(end), step(step), body(body) {}
+/************************** Loop analysis *************************/
+// Raccoglie le variabili che il ciclo può scrivere durante l'esecuzione
+static void collectAssigned(RootAST* node, llvm::SmallDenseSet<Symbol, 8>& assigned)
+{
+    if (auto* binary = llvm::dyn_cast<BinaryExprAST>(node))
+        if (binary->getOp() == Operator::ASSIGN)
+            if (auto* variable = llvm::dyn_cast<VariableExprAST>(binary->getLHS()))
+                assigned.insert(variable->getName());
+
+    forEachChild(node, [&assigned](ExprAST*& child) { collectAssigned(child, assigned); });
+}
+
+static bool readsOnly(ExprAST* expr, const llvm::SmallDenseSet<Symbol, 8>& assigned)
+{
+    // Gli elementi di un array possono essere scritti con qualsiasi indice: mai invarianti
+    if (llvm::isa<ArrayIndexingExprAST>(expr))
+        return false;
+    if (auto* variable = llvm::dyn_cast<VariableExprAST>(expr))
+        return !assigned.count(variable->getName());
+
+    bool invariant = true;
+    forEachChild(expr, [&](ExprAST*& child) { invariant = invariant && readsOnly(child, assigned); });
+    return invariant;
+}
+
+// Un'espressione invariante rispetto al ciclo non ha effetti collaterali e
+// legge solo variabili che il ciclo non scrive mai, quindi può essere
+// valutata una volta nel preheader
+static bool isLoopInvariant(ExprAST* expr, const llvm::SmallDenseSet<Symbol, 8>& assigned)
+{
+    return isPure(expr) && readsOnly(expr, assigned);
+}
+
+static llvm::CmpInst::Predicate comparisonPredicate(Operator op)
+{
+    switch (op)
+    {
+        case Operator::LESS_THAN:
+            return llvm::CmpInst::FCMP_ULT;
+        case Operator::LESS_EQUAL:
+            return llvm::CmpInst::FCMP_ULE;
+        case Operator::GREATER_THAN:
+            return llvm::CmpInst::FCMP_UGT;
+        case Operator::GREATER_EQUAL:
+            return llvm::CmpInst::FCMP_UGE;
+        case Operator::EQUAL:
+            return llvm::CmpInst::FCMP_UEQ;
+        default:
+            return llvm::CmpInst::FCMP_UNE;
+    }
+}
+
+// Numero di esecuzioni del corpo di un ciclo for con inizio, passo e limite
+// costanti, trovato ripetendo la stessa aritmetica double del ciclo. I cicli
+// più lunghi del limite sono lasciati alle analisi di LLVM.
+static std::optional<uint32_t> constantTripCount(double start, double step, Operator op, double bound)
+{
+    constexpr uint32_t limit = 1 << 16;
+    double value = start;
+
+    // Il corpo viene sempre eseguito una volta prima di valutare la condizione
+    for (uint32_t trips = 1; trips < limit; ++trips)
+    {
+        value += step;
+        if (!compareUnordered(op, value, bound))
+            return trips;
+    }
+    return std::nullopt;
+}
+
+// Nodo llvm.loop autoreferenziale con le indicazioni scritte nel sorgente
+static llvm::MDNode* loopMetadata(driver& drv, const LoopHints& hints)
+{
+    llvm::LLVMContext& context = *drv.context;
+    llvm::Type* int32 = llvm::Type::getInt32Ty(context);
+    llvm::SmallVector<llvm::Metadata*, 4> operands = {nullptr};
+
+    auto addHint = [&](llvm::StringRef name, llvm::Constant* value) {
+        operands.push_back(llvm::MDNode::get(context, {llvm::MDString::get(context, name), llvm::ConstantAsMetadata::get(value)}));
+    };
+
+    if (hints.unroll)
+        addHint("llvm.loop.unroll.count", llvm::ConstantInt::get(int32, hints.unroll));
+    if (hints.vectorize)
+        addHint("llvm.loop.vectorize.enable", llvm::ConstantInt::getTrue(context));
+    if (hints.vectorWidth)
+        addHint("llvm.loop.vectorize.width", llvm::ConstantInt::get(int32, hints.vectorWidth));
 
-llvm::Value* ForExprAST::codegen(driver& drv)
+    if (operands.size() == 1)
+        return nullptr;
+
+    llvm::MDNode* loopID = llvm::MDNode::getDistinct(context, operands);
+    loopID->replaceOperandWith(0, loopID);
+    return loopID;
+}
+
+/************************* Array analysis *************************/
+// Vero se il sottoalbero si riferisce a name in qualsiasi modo: una
+// lettura, una scrittura o una dichiarazione che lo nasconderebbe
+static bool mentions(RootAST* node, Symbol name)
+{
+    switch (node->getKind())
+    {
+        case RootAST::AK_Variable:
+            if (llvm::cast<VariableExprAST>(node)->getName() == name)
+                return true;
+            break;
+        case RootAST::AK_ArrayIndexing:
+            if (llvm::cast<ArrayIndexingExprAST>(node)->getName() == name)
+                return true;
+            break;
+        case RootAST::AK_ArrayInit:
+            if (llvm::cast<ArrayInitExprAST>(node)->getName() == name)
+                return true;
+            break;
+        case RootAST::AK_For:
+            if (llvm::cast<ForExprAST>(node)->getVarName() == name)
+                return true;
+            break;
+        case RootAST::AK_Var:
+            for (const auto& binding : llvm::cast<VarExprAST>(node)->getVarNames())
+                if (binding.first == name)
+                    return true;
+            break;
+        default:
+            break;
+    }
+
+    bool found = false;
+    forEachChild(node, [&](ExprAST*& child) { found = found || mentions(child, name); });
+    return found;
+}
+
+// Divide una sequenza ':' nelle espressioni che valuta, in ordine
+static void flattenSequence(ExprAST* expr, llvm::SmallVectorImpl<ExprAST*>& statements)
+{
+    auto* sequence = llvm::dyn_cast<BinaryExprAST>(expr);
+
+    if (sequence && sequence->getOp() == Operator::COLON)
+    {
+        flattenSequence(sequence->getLHS(), statements);
+        flattenSequence(sequence->getRHS(), statements);
+    }
+    else
+    {
+        statements.push_back(expr);
+    }
+}
+
+// Dimostra che il blocco var inizia scrivendo ogni elemento dell'array
+// prima che qualcosa possa leggerlo, quindi l'azzeramento sarebbe inutile.
+// La forma riconosciuta è
+//   for i = 0, i < N [, 1] in ... : a[i] = e : ... end    (N >= capacità)
+// valutata per prima nel blocco, dove il corpo del ciclo scrive a[i]
+// incondizionatamente, non assegna mai i e non usa a in altri modi. Le
+// dichiarazioni che seguono a nello stesso blocco non devono riferirsi ad a.
+static bool overwrittenBeforeRead(ArrayInitExprAST* array, llvm::ArrayRef<std::pair<Symbol, ExprAST*>> laterBindings, ExprAST* body)
+{
+    Symbol name = array->getName();
+
+    for (const auto& binding : laterBindings)
+        if (mentions(binding.second, name))
+            return false;
+
+    llvm::SmallVector<ExprAST*, 4> blockStatements;
+    flattenSequence(body, blockStatements);
+
+    auto* loop = llvm::dyn_cast<ForExprAST>(blockStatements.front());
+    if (!loop || loop->getVarName() == name)
+        return false;
+
+    auto* start = llvm::dyn_cast<NumberExprAST>(loop->getStart());
+    auto* step = loop->getStep() ? llvm::dyn_cast<NumberExprAST>(loop->getStep()) : nullptr;
+    if (!start || start->getVal() != 0.0 || (loop->getStep() && (!step || step->getVal() != 1.0)))
+        return false;
+
+    auto* condition = llvm::dyn_cast<BinaryExprAST>(loop->getEnd());
+    if (!condition)
+        return false;
+
+    auto* inductionVar = llvm::dyn_cast<VariableExprAST>(condition->getLHS());
+    auto* bound = llvm::dyn_cast<NumberExprAST>(condition->getRHS());
+    if (!inductionVar || inductionVar->getName() != loop->getVarName() || !bound)
+        return false;
+
+    // Gli indici 0, 1, ... vengono scritti finché la condizione vale
+    double capacity = array->getCapacity();
+    bool coversArray = (condition->getOp() == Operator::LESS_THAN && bound->getVal() >= capacity) ||
+                       (condition->getOp() == Operator::LESS_EQUAL && bound->getVal() >= capacity - 1);
+    if (!coversArray)
+        return false;
+
+    llvm::SmallDenseSet<Symbol, 8> assigned;
+    collectAssigned(loop->getBody(), assigned);
+    if (assigned.count(loop->getVarName()))
+        return false;
+
+    llvm::SmallVector<ExprAST*, 4> loopStatements;
+    flattenSequence(loop->getBody(), loopStatements);
+
+    bool stored = false;
+    for (ExprAST* statement : loopStatements)
+    {
+        auto* assignment = llvm::dyn_cast<BinaryExprAST>(statement);
+        auto* element = assignment && assignment->getOp() == Operator::ASSIGN ? llvm::dyn_cast<ArrayIndexingExprAST>(assignment->getLHS()) : nullptr;
+
+        if (!stored && element && element->getName() == name)
+        {
+            auto* index = llvm::dyn_cast<VariableExprAST>(element->getIndex());
+            if (!index || index->getName() != loop->getVarName() || mentions(assignment->getRHS(), name))
+                return false;
+            stored = true;
+        }
+        else if (mentions(statement, name))
+        {
+            return false;
+        }
+    }
+
+    return stored;
+}
+
+/************************* Bounds checking ************************/
+// Vero se il sottoalbero dichiara name (binding var, array o variabile di un for)
+static bool declares(RootAST* node, Symbol name)
+{
+    if (auto* loop = llvm::dyn_cast<ForExprAST>(node))
+        if (loop->getVarName() == name)
+            return true;
+    if (auto* array = llvm::dyn_cast<ArrayInitExprAST>(node))
+        if (array->getName() == name)
+            return true;
+    if (auto* block = llvm::dyn_cast<VarExprAST>(node))
+        for (const auto& binding : block->getVarNames())
+            if (binding.first == name)
+                return true;
+
+    bool found = false;
+    forEachChild(node, [&](ExprAST*& child) { found = found || declares(child, name); });
+    return found;
+}
+
+// Array usati come a[indice] da qualche parte nel sottoalbero
+static void collectIndexedArrays(RootAST* node, Symbol index, llvm::SmallVectorImpl<Symbol>& arrays)
+{
+    if (auto* access = llvm::dyn_cast<ArrayIndexingExprAST>(node))
+    {
+        auto* variable = llvm::dyn_cast<VariableExprAST>(access->getIndex());
+        if (variable && variable->getName() == index && !llvm::is_contained(arrays, access->getName()))
+            arrays.push_back(access->getName());
+    }
+
+    forEachChild(node, [&](ExprAST*& child) { collectIndexedArrays(child, index, arrays); });
+}
+
+// Accessi a[index] che il sottoalbero esegue ogni volta che viene valutato:
+// non scende nei rami di un if né nei corpi dei cicli annidati, di cui
+// considera solo ciò che viene valutato almeno una volta
+static void collectUnconditionalAccesses(RootAST* node, Symbol index, llvm::SmallVectorImpl<ArrayIndexingExprAST*>& accesses)
+{
+    auto visit = [&](ExprAST* child) {
+        if (child)
+            collectUnconditionalAccesses(child, index, accesses);
+    };
+
+    if (auto* access = llvm::dyn_cast<ArrayIndexingExprAST>(node))
+    {
+        auto* variable = llvm::dyn_cast<VariableExprAST>(access->getIndex());
+        if (variable && variable->getName() == index)
+            accesses.push_back(access);
+    }
+    else if (auto* ifExpr = llvm::dyn_cast<IfExprNode>(node))
+    {
+        return visit(ifExpr->getCondition());
+    }
+    else if (auto* loop = llvm::dyn_cast<ForExprAST>(node))
+    {
+        return visit(loop->getStart());
+    }
+    else if (auto* loop = llvm::dyn_cast<WhileExprAST>(node))
+    {
+        return visit(loop->getCondition());
+    }
+
+    forEachChild(node, [&](ExprAST*& child) { visit(child); });
+}
+
+// Blocco freddo condiviso che termina il programma con un indice fuori dai
+// limiti (o un array sullo heap che non è stato possibile allocare)
+static llvm::BasicBlock* boundsTrapBlock(driver& drv)
+{
+    llvm::Function* function = drv.builder->GetInsertBlock()->getParent();
+
+    if (!drv.boundsTrap || drv.boundsTrap->getParent() != function)
+    {
+        drv.boundsTrap = llvm::BasicBlock::Create(*drv.context, "boundstrap", function);
+        llvm::IRBuilder<> trapBuilder(drv.boundsTrap);
+        llvm::CallInst* trap = trapBuilder.CreateCall(llvm::Intrinsic::getDeclaration(drv.module.get(), llvm::Intrinsic::trap));
+        trap->addFnAttr(llvm::Attribute::Cold);
+        trapBuilder.CreateUnreachable();
+    }
+
+    return drv.boundsTrap;
+}
+
+// Prosegue in un nuovo blocco se inRange vale, altrimenti termina il programma
+void branchToTrapUnless(driver& drv, llvm::Value* inRange, llvm::StringRef name)
+{
+    llvm::Function* function = drv.builder->GetInsertBlock()->getParent();
+    llvm::BasicBlock* trap = boundsTrapBlock(drv);
+    llvm::BasicBlock* cont = llvm::BasicBlock::Create(*drv.context, name, function);
+
+    drv.builder->CreateCondBr(inRange, cont, trap, llvm::MDBuilder(*drv.context).createBranchWeights(1 << 20, 1));
+    drv.builder->SetInsertPoint(cont);
+}
+
+static bool isConstantInRange(double value, uint64_t capacity)
+{
+    return value >= 0 && value < double(capacity);
+}
+
+// Chiamata nel preheader di un ciclo for la cui variabile di induzione
+// cambia solo con il passo. Con inizio, passo e limite costanti i valori
+// assunti dalla variabile vengono ripercorsi e ogni accesso a[i] che resta
+// nei limiti viene registrato; con passo unitario e limite invariante viene
+// emesso un solo controllo, valido per tutte le iterazioni, per gli accessi
+// a[i] che il corpo esegue a ogni iterazione. Il corpo salta poi i controlli
+// di questi accessi.
+static void checkLoopAccesses(driver& drv, ForExprAST* loop, llvm::Value* startValue, llvm::Value* stepVal, Operator op, llvm::Value* boundVal)
+{
+    Symbol index = loop->getVarName();
+
+    if ((op != Operator::LESS_THAN && op != Operator::LESS_EQUAL) || declares(loop->getBody(), index))
+        return;
+
+    llvm::SmallVector<Symbol, 4> names;
+    collectIndexedArrays(loop->getBody(), index, names);
+
+    // Gli array dichiarati nel corpo non sono quelli visibili qui, e i
+    // parametri array non hanno una lunghezza nota
+    llvm::SmallVector<Symbol, 4> arrays;
+    for (Symbol name : names)
+    {
+        Binding binding = drv.symbolTable.lookup(name);
+        if (name == index || !binding.address || !binding.type->isArrayTy() || binding.type->getArrayNumElements() == 0 ||
+            declares(loop->getBody(), name))
+            continue;
+        arrays.push_back(name);
+    }
+
+    if (arrays.empty())
+        return;
+
+    // Un contatore intero viene controllato attraverso i suoi valori double
+    auto asDouble = [&drv](llvm::Value* value) {
+        return value->getType()->isIntegerTy() ? drv.builder->CreateSIToFP(value, drv.builder->getDoubleTy()) : value;
+    };
+    startValue = asDouble(startValue);
+    stepVal = asDouble(stepVal);
+    boundVal = asDouble(boundVal);
+
+    auto* constStart = llvm::dyn_cast<llvm::ConstantFP>(startValue);
+    auto* constStep = llvm::dyn_cast<llvm::ConstantFP>(stepVal);
+    auto* constBound = llvm::dyn_cast<llvm::ConstantFP>(boundVal);
+
+    if (constStart && constStep && constBound)
+    {
+        double value = constStart->getValueAPF().convertToDouble();
+        double lowest = value, highest = value;
+        double stepValue = constStep->getValueAPF().convertToDouble();
+        double bound = constBound->getValueAPF().convertToDouble();
+        constexpr unsigned limit = 1 << 16;
+        unsigned trips = 1;
+
+        for (; trips < limit; ++trips)
+        {
+            value += stepValue;
+            if (!compareUnordered(op, value, bound))
+                break;
+            lowest = std::min(lowest, value);
+            highest = std::max(highest, value);
+        }
+
+        if (trips == limit || std::isnan(lowest) || std::isnan(highest))
+            return;
+
+        for (Symbol name : arrays)
+        {
+            uint64_t capacity = drv.symbolTable.lookup(name).type->getArrayNumElements();
+            if (isConstantInRange(lowest, capacity) && isConstantInRange(highest, capacity))
+                drv.checkedIndices.push_back({index, name, nullptr});
+        }
+        return;
+    }
+
+    if (!constStep || !constStep->isExactlyValue(1.0))
+        return;
+
+    // Il controllo anticipato fallisce anche per indici che il programma non
+    // usa: vale solo per gli accessi eseguiti a ogni iterazione, gli altri
+    // restano controllati uno per uno
+    llvm::SmallVector<ArrayIndexingExprAST*, 4> accesses;
+    collectUnconditionalAccesses(loop->getBody(), index, accesses);
+    llvm::erase_if(accesses, [&](ArrayIndexingExprAST* access) { return !llvm::is_contained(arrays, access->getName()); });
+    if (accesses.empty())
+        return;
+
+    uint64_t minCapacity = UINT64_MAX;
+    for (ArrayIndexingExprAST* access : accesses)
+        minCapacity = std::min(minCapacity, drv.symbolTable.lookup(access->getName()).type->getArrayNumElements());
+
+    // Con passo unitario l'ultimo valore è start + ceil(bound - start) - 1
+    // per "<" e start + floor(bound - start) per "<=". I confronti ordered
+    // fanno fallire il controllo se inizio o limite sono NaN.
+    llvm::IRBuilder<>& builder = *drv.builder;
+    llvm::Type* doubleTy = builder.getDoubleTy();
+    llvm::Value* distance = builder.CreateFSub(boundVal, startValue, "distance");
+    llvm::Value* last = nullptr;
+
+    if (op == Operator::LESS_THAN)
+    {
+        llvm::Value* count = builder.CreateUnaryIntrinsic(llvm::Intrinsic::ceil, distance);
+        last = builder.CreateFSub(builder.CreateFAdd(startValue, count), llvm::ConstantFP::get(doubleTy, 1.0), "last");
+    }
+    else
+    {
+        llvm::Value* count = builder.CreateUnaryIntrinsic(llvm::Intrinsic::floor, distance);
+        last = builder.CreateFAdd(startValue, count, "last");
+    }
+
+    llvm::Value* capacity = llvm::ConstantFP::get(doubleTy, double(minCapacity));
+    llvm::Value* inRange = builder.CreateAnd(builder.CreateFCmpOGE(startValue, llvm::ConstantFP::get(doubleTy, 0.0)),
+                                             builder.CreateFCmpOLT(startValue, capacity));
+    inRange = builder.CreateAnd(inRange, builder.CreateFCmpOLT(last, capacity), "loopinbounds");
+
+    branchToTrapUnless(drv, inRange, "preheader");
+    ++drv.boundsChecksEmitted;
+
+    for (ArrayIndexingExprAST* access : accesses)
+        drv.checkedIndices.push_back({index, access->getName(), access});
+}
+
+// Controllo di un indice a ogni accesso, a meno che il suo intervallo sia già noto
+static void checkIndex(driver& drv, const ArrayIndexingExprAST* access, ExprAST* indexExpr, llvm::Value* index, uint64_t capacity)
+{
+    if (auto* number = llvm::dyn_cast<NumberExprAST>(indexExpr))
+    {
+        if (isConstantInRange(number->getVal(), capacity))
+        {
+            ++drv.boundsChecksEliminated;
+            return;
+        }
+    }
+    else if (auto* variable = llvm::dyn_cast<VariableExprAST>(indexExpr))
+    {
+        for (const auto& checked : drv.checkedIndices)
+        {
+            if (checked.index == variable->getName() && checked.array == access->getName() && (!checked.access || checked.access == access))
+            {
+                ++drv.boundsChecksEliminated;
+                drv.boundsChecksHoisted += checked.access != nullptr;
+                return;
+            }
+        }
+    }
+
+    llvm::IRBuilder<>& builder = *drv.builder;
+    llvm::Value* inRange = nullptr;
+
+    // Un indice i64 è negativo esattamente quando, senza segno, supera la capacità
+    if (index->getType()->isIntegerTy())
+    {
+        inRange = builder.CreateICmpULT(index, builder.getInt64(capacity), "inbounds");
+    }
+    else
+    {
+        inRange = builder.CreateAnd(builder.CreateFCmpOGE(index, llvm::ConstantFP::get(builder.getDoubleTy(), 0.0)),
+                                    builder.CreateFCmpOLT(index, llvm::ConstantFP::get(builder.getDoubleTy(), double(capacity))),
+                                    "inbounds");
+    }
+    branchToTrapUnless(drv, inRange, "indexok");
+    ++drv.boundsChecksEmitted;
+}
+
+// Valore di una costante double o i64
+static std::optional<double> constantDouble(llvm::Value* value)
+{
+    if (auto* constant = llvm::dyn_cast_or_null<llvm::ConstantFP>(value))
+        return constant->getValueAPF().convertToDouble();
+    if (auto* constant = llvm::dyn_cast_or_null<llvm::ConstantInt>(value))
+        return double(constant->getSExtValue());
+    return std::nullopt;
+}
+
+// Limite i64 k tale che "i op k" equivale a "i op bound" per ogni intero i
+// entro ±2^53: ceil per "<" e ">=", floor per "<=" e ">". La restrizione a
+// ±2^53 trasforma gli infiniti in limiti finiti equivalenti e un NaN, che
+// nei confronti unordered dà vero, in uno che nessun contatore raggiunge.
+static llvm::Value* integerBound(driver& drv, Operator op, llvm::Value* bound)
+{
+    llvm::IRBuilder<>& builder = *drv.builder;
+    constexpr double limit = 9007199254740992.0; // 2^53
+    bool roundUp = op == Operator::LESS_THAN || op == Operator::GREATER_EQUAL;
+    bool nanHigh = op == Operator::LESS_THAN || op == Operator::LESS_EQUAL;
+
+    if (auto value = constantDouble(bound))
+    {
+        double k = std::isnan(*value) ? (nanHigh ? limit : -limit) : std::clamp(roundUp ? std::ceil(*value) : std::floor(*value), -limit, limit);
+        return builder.getInt64(int64_t(k));
+    }
+
+    llvm::Value* high = llvm::ConstantFP::get(builder.getDoubleTy(), limit);
+    llvm::Value* low = llvm::ConstantFP::get(builder.getDoubleTy(), -limit);
+    llvm::Value* k = builder.CreateUnaryIntrinsic(roundUp ? llvm::Intrinsic::ceil : llvm::Intrinsic::floor, bound);
+
+    // minnum e maxnum restituiscono l'altro operando se uno è NaN
+    if (nanHigh)
+        k = builder.CreateMaxNum(builder.CreateMinNum(k, high), low);
+    else
+        k = builder.CreateMinNum(builder.CreateMaxNum(k, low), high);
+    return builder.CreateFPToSI(k, builder.getInt64Ty(), "intbound");
+}
+
+ForExprAST::ForExprAST(Symbol varName, ExprAST* start, ExprAST* end, ExprAST* step, ExprAST* body, LoopHints hints) :
+    ExprAST(AK_For), varName(varName), start(start), end(end), step(step), body(body), hints(hints) {}
+
+// Il corpo viene eseguito almeno una volta e la condizione è valutata in
+// fondo: è già la forma ruotata su cui lavorano le passate sui cicli di
+// LLVM. Passo e limite sono calcolati nel preheader quando il ciclo non può
+// cambiarli, così il latch è una sola somma e un confronto sulla variabile
+// di induzione. Una variabile di induzione intera (vedi inferIntegers) sta
+// in un i64.
+llvm::Value* ForExprAST::codegenValue(driver& drv)
 {
     llvm::Function* f = drv.builder->GetInsertBlock()->getParent();
-    llvm::AllocaInst* alloca = CreateEntryBlockAlloca(drv, f, varName);
-    llvm::Value* startValue = start->codegen(drv);
+    llvm::Type* doubleTy = llvm::Type::getDoubleTy(*drv.context);
+    llvm::Type* varType = integerInduction ? llvm::Type::getInt64Ty(*drv.context) : doubleTy;
+    llvm::AllocaInst* alloca = CreateEntryBlockAlloca(drv, f, drv.interner.name(varName), varType);
+    llvm::Value* startValue = integerInduction ? codegenInteger(drv, start) : start->codegenValue(drv);
 
     drv.builder->CreateStore(startValue, alloca);
 
+    llvm::SmallDenseSet<Symbol, 8> assigned;
+    collectAssigned(body, assigned);
+    collectAssigned(end, assigned);
+    if (step)
+        collectAssigned(step, assigned);
+    bool inductionWritten = assigned.count(varName);
+    assigned.insert(varName);
+
+    llvm::Value* stepVal = nullptr;
+
+    if (integerInduction)
+    {
+        stepVal = step ? codegenInteger(drv, step) : drv.builder->getInt64(1);
+    }
+    else if (step == nullptr)
+    {
+        stepVal = llvm::ConstantFP::get(*drv.context, llvm::APFloat(1.0));
+    }
+    else if (isLoopInvariant(step, assigned))
+    {
+        stepVal = step->codegenValue(drv);
+    }
+
+    // "i < n" (o ogni altro confronto della variabile di induzione con un
+    // limite invariante) viene valutato direttamente sul limite precalcolato
+    auto* condition = llvm::dyn_cast<BinaryExprAST>(end);
+    llvm::Value* boundVal = nullptr;
+
+    if (condition && isComparison(condition->getOp()))
+    {
+        auto* variable = llvm::dyn_cast<VariableExprAST>(condition->getLHS());
+
+        if (variable && variable->getName() == varName && isLoopInvariant(condition->getRHS(), assigned))
+        {
+            ExprAST* bound = condition->getRHS();
+            Operator op = condition->getOp();
+
+            // Un contatore intero viene confrontato in i64, a meno che il
+            // limite sia un double confrontato per uguaglianza
+            if (integerInduction && currentIntegerRange(drv, bound))
+                boundVal = codegenInteger(drv, bound);
+            else if (integerInduction && op != Operator::EQUAL && op != Operator::NOT_EQUAL)
+                boundVal = integerBound(drv, op, bound->codegenValue(drv));
+            else
+                boundVal = bound->codegenValue(drv);
+        }
+    }
+
+    // Gli accessi a[i] nel corpo sono dimostrati nei limiti qui, o controllati una volta sola
+    size_t checkedMark = drv.checkedIndices.size();
+
+    if (drv.boundsCheck && !inductionWritten && condition && boundVal && stepVal)
+    {
+        checkLoopAccesses(drv, this, startValue, stepVal, condition->getOp(), boundVal);
+    }
+
     llvm::BasicBlock* loopBB = llvm::BasicBlock::Create(*drv.context, "loop", f);
 
     drv.builder->CreateBr(loopBB);
 
     drv.builder->SetInsertPoint(loopBB);
 
-    llvm::AllocaInst* oldVal = drv.symbolTable[varName];
-    drv.symbolTable[varName] = alloca;
+    // La variabile di induzione nasconde ogni variabile esterna con lo stesso nome
+    SymbolTable::Scope scope(drv.symbolTable);
+    drv.symbolTable.bind(varName, {alloca, alloca->getAllocatedType()});
 
-    body->codegen(drv);
+    body->codegenValue(drv);
 
-    llvm::Value* stepVal = nullptr;
+    drv.checkedIndices.resize(checkedMark);
 
-    if (step != nullptr)
-    {
-        stepVal = step->codegen(drv);
-    }
-    else
+    if (stepVal == nullptr)
     {
-        stepVal = llvm::ConstantFP::get(*drv.context, llvm::APFloat(1.0));
+        stepVal = step->codegenValue(drv);
     }
 
-    llvm::Value* currentVar = drv.builder->CreateLoad(alloca->getAllocatedType(), alloca, varName);
+    llvm::Value* currentVar = drv.builder->CreateLoad(alloca->getAllocatedType(), alloca, drv.interner.name(varName));
 
-    llvm::Value* nextVar = drv.builder->CreateFAdd(currentVar, stepVal, "nextvar");
+    llvm::Value* nextVar = integerInduction ? drv.builder->CreateNSWAdd(currentVar, stepVal, "nextvar")
+                                            : drv.builder->CreateFAdd(currentVar, stepVal, "nextvar");
 
     drv.builder->CreateStore(nextVar, alloca);
 
-    llvm::Value* endCond = end->codegen(drv);
+    llvm::Value* endCond = nullptr;
 
-    endCond = drv.builder->CreateFCmpONE(endCond, llvm::ConstantFP::get(*drv.context, llvm::APFloat(0.0)), "loopcond");
+    if (boundVal && boundVal->getType()->isIntegerTy())
+    {
+        endCond = drv.builder->CreateICmp(integerPredicate(condition->getOp()), nextVar, boundVal, "loopcond");
+    }
+    else if (boundVal)
+    {
+        llvm::Value* nextValue = integerInduction ? drv.builder->CreateSIToFP(nextVar, doubleTy) : nextVar;
+        endCond = drv.builder->CreateFCmp(comparisonPredicate(condition->getOp()), nextValue, boundVal, "loopcond");
+    }
+    else
+    {
+        endCond = end->codegenValue(drv);
+        endCond = drv.builder->CreateFCmpONE(endCond, llvm::ConstantFP::get(*drv.context, llvm::APFloat(0.0)), "loopcond");
+    }
 
     llvm::BasicBlock* afterBB = llvm::BasicBlock::Create(*drv.context, "afterloop", f);
 
-    drv.builder->CreateCondBr(endCond, loopBB, afterBB);
+    llvm::BranchInst* latch = drv.builder->CreateCondBr(endCond, loopBB, afterBB);
 
-    drv.builder->SetInsertPoint(afterBB);
+    auto constStart = constantDouble(startValue);
+    auto constStep = constantDouble(stepVal);
+    auto constBound = constantDouble(boundVal);
 
-    if (oldVal != nullptr)
+    if (constStart && constStep && constBound)
     {
-        drv.symbolTable[varName] = oldVal;
+        // L'arco all'indietro viene percorso trips - 1 volte
+        if (auto trips = constantTripCount(*constStart, *constStep, condition->getOp(), *constBound))
+        {
+            latch->setMetadata(llvm::LLVMContext::MD_prof, llvm::MDBuilder(*drv.context).createBranchWeights(*trips - 1, 1));
+        }
     }
-    else
+
+    if (llvm::MDNode* loopID = loopMetadata(drv, hints))
     {
-        drv.symbolTable.erase(varName);
+        latch->setMetadata(llvm::LLVMContext::MD_loop, loopID);
     }
 
+    drv.builder->SetInsertPoint(afterBB);
+
     return llvm::Constant::getNullValue(llvm::Type::getDoubleTy(*drv.context));
 }
 
-WhileExprAST::WhileExprAST(ExprAST* condition, ExprAST* body) :
-    condition(condition), body(body) {}
+WhileExprAST::WhileExprAST(ExprAST* condition, ExprAST* body, LoopHints hints) :
+    ExprAST(AK_While), condition(condition), body(body), hints(hints) {}
 
-llvm::Value* WhileExprAST::codegen(driver& drv)
+llvm::Value* WhileExprAST::codegenValue(driver& drv)
 {
     llvm::Function* currentFunction = drv.builder->GetInsertBlock()->getParent();
     llvm::BasicBlock* loopBlock = llvm::BasicBlock::Create(*drv.context, "whileloop", currentFunction);
@@ -600,131 +1428,199 @@ llvm::Value* WhileExprAST::codegen(driver& drv)
     drv.builder->CreateBr(loopBlock);
     drv.builder->SetInsertPoint(loopBlock);
 
-    body->codegen(drv);
+    body->codegenValue(drv);
 
-    llvm::Value* endCondition = condition->codegen(drv);
+    llvm::Value* endCondition = condition->codegenValue(drv);
 
     endCondition = drv.builder->CreateFCmpONE(endCondition, llvm::ConstantFP::get(*drv.context, llvm::APFloat(0.0)), "whileloopcond");
 
     llvm::BasicBlock* afterLoopBlock = llvm::BasicBlock::Create(*drv.context, "afterwhileloop", currentFunction);
 
-    drv.builder->CreateCondBr(endCondition, loopBlock, afterLoopBlock);
+    llvm::BranchInst* latch = drv.builder->CreateCondBr(endCondition, loopBlock, afterLoopBlock);
+
+    if (llvm::MDNode* loopID = loopMetadata(drv, hints))
+    {
+        latch->setMetadata(llvm::LLVMContext::MD_loop, loopID);
+    }
+
     drv.builder->SetInsertPoint(afterLoopBlock);
 
     return llvm::ConstantFP::getNullValue(llvm::Type::getDoubleTy(*drv.context));
 }
 
-VarExprAST::VarExprAST(std::vector<std::pair<std::string, ExprAST*>> varNames, ExprAST* body) :
-    varNames(varNames), body(body) {}
+VarExprAST::VarExprAST(llvm::MutableArrayRef<std::pair<Symbol, ExprAST*>> varNames, ExprAST* body) :
+    ExprAST(AK_Var), varNames(varNames), body(body) {}
 
-llvm::Value* VarExprAST::codegen(driver& drv)
+llvm::Value* VarExprAST::codegenValue(driver& drv)
 {
-    std::unordered_map<std::string, llvm::AllocaInst*> oldSymbols; // variables defined in varexpr block hides other variables in the enclosing block with the same name
+    // variables defined in varexpr block hides other variables in the enclosing block with the same name
+    SymbolTable::Scope scope(drv.symbolTable);
     auto currentFunction = drv.builder->GetInsertBlock()->getParent();
+    llvm::SmallVector<llvm::Value*, 2> heapArrays; // rilasciati alla fine del blocco
 
     for (unsigned int i = 0, e = varNames.size(); i != e; i++)
     {
-        const std::string& varName = varNames[i].first;
+        Symbol varName = varNames[i].first;
         ExprAST* varInitialValueExpr = varNames[i].second;
         llvm::Value* initialValue = nullptr;
         llvm::AllocaInst* allocaInstr = nullptr;
 
-        if (ArrayInitExprAST* arrayInitExpr = dynamic_cast<ArrayInitExprAST*>(varInitialValueExpr))
+        if (auto* arrayInitExpr = llvm::dyn_cast<ArrayInitExprAST>(varInitialValueExpr))
         {
-            allocaInstr = arrayInitExpr->codegen(drv);
+            bool zeroInit = !overwrittenBeforeRead(arrayInitExpr, varNames.drop_front(i + 1), body);
+            llvm::Value* storage = arrayInitExpr->allocate(drv, zeroInit);
+
+            if (arrayInitExpr->onHeap(drv))
+                heapArrays.push_back(storage);
+
+            drv.symbolTable.bind(varName, {storage, arrayInitExpr->getType(drv)});
+            continue;
         }
         else
         {
+            // Le variabili intere (vedi inferIntegers) stanno in un i64
+            llvm::Type* type = isInteger(i) ? llvm::Type::getInt64Ty(*drv.context) : llvm::Type::getDoubleTy(*drv.context);
+
             if (varInitialValueExpr == nullptr)
             {
-                initialValue = llvm::ConstantFP::get(llvm::Type::getDoubleTy(*drv.context), 0.0);
+                initialValue = llvm::Constant::getNullValue(type);
+            }
+            else if (isInteger(i))
+            {
+                initialValue = codegenInteger(drv, varInitialValueExpr);
             }
             else
             {
-                initialValue = varInitialValueExpr->codegen(drv);
+                initialValue = varInitialValueExpr->codegenValue(drv);
             }
 
-            allocaInstr = CreateEntryBlockAlloca(drv, currentFunction, varName);
+            allocaInstr = CreateEntryBlockAlloca(drv, currentFunction, drv.interner.name(varName), type);
 
             drv.builder->CreateStore(initialValue, allocaInstr);
         }
 
-        auto* oldValue = drv.symbolTable[varName];
+        drv.symbolTable.bind(varName, {allocaInstr, allocaInstr->getAllocatedType()});
+    }
 
-        if (oldValue)
-        {
-            oldSymbols.insert(std::pair(varName, oldValue));
-        }
+    llvm::Value* bodyVal = body->codegenValue(drv);
 
-        drv.symbolTable[varName] = allocaInstr;
+    for (llvm::Value* storage : heapArrays)
+    {
+        drv.builder->CreateCall(drv.module->getOrInsertFunction("free", drv.builder->getVoidTy(), pointerType(drv)), {storage});
     }
 
-    llvm::Value* bodyVal = nullptr;
+    return bodyVal;
+}
+
+double NumberExprAST::getVal() const
+{
+    return this->Val;
+}
+
+ArrayInitExprAST::ArrayInitExprAST(Symbol name, unsigned int capacity) :
+    ExprAST(AK_ArrayInit), name(name), capacity(capacity) {}
+
+Symbol ArrayInitExprAST::getName() const { return this->name; }
+
+llvm::ArrayType* ArrayInitExprAST::getType(driver& drv) const
+{
+    return llvm::ArrayType::get(llvm::Type::getDoubleTy(*drv.context), this->capacity);
+}
 
-    if (ArrayIndexingExprAST* arrayIndexingExpr = dynamic_cast<ArrayIndexingExprAST*>(body))
+bool ArrayInitExprAST::onHeap(const driver& drv) const
+{
+    return uint64_t(sizeof(double)) * this->capacity > drv.stackArrayLimit;
+}
+
+llvm::Value* ArrayInitExprAST::allocate(driver& drv, bool zeroInit)
+{
+    llvm::LLVMContext& context = *drv.context;
+    llvm::Type* int64 = llvm::Type::getInt64Ty(context);
+    uint64_t arraySizeInBytes = uint64_t(sizeof(double)) * this->capacity;
+    llvm::Align align(drv.arrayAlign);
+    llvm::Value* storage = nullptr;
+
+    if (onHeap(drv))
     {
-        // bodyVal is a GEP
-        auto* gep = arrayIndexingExpr->codegen(drv);
-        bodyVal = drv.builder->CreateLoad(llvm::Type::getDoubleTy(*drv.context), gep);
+        // aligned_alloc vuole una dimensione multipla dell'allineamento
+        uint64_t allocSize = llvm::alignTo(arraySizeInBytes, align);
+        llvm::FunctionCallee alignedAlloc = drv.module->getOrInsertFunction("aligned_alloc", pointerType(drv), int64, int64);
+        auto* call = drv.builder->CreateCall(alignedAlloc, {llvm::ConstantInt::get(int64, align.value()), llvm::ConstantInt::get(int64, allocSize)},
+                                             drv.interner.name(this->name));
+        call->addRetAttr(llvm::Attribute::getWithAlignment(context, align));
+        storage = call;
+
+        // Se la memoria non basta il programma termina come per un indice
+        // fuori dai limiti, invece di scrivere all'indirizzo nullo
+        branchToTrapUnless(drv, drv.builder->CreateIsNotNull(call), "allocated");
     }
     else
     {
-        bodyVal = body->codegen(drv);
+        // alloca nel blocco di ingresso: uno slot sullo stack per
+        // dichiarazione, anche dentro un ciclo, che SROA e mem2reg possono
+        // promuovere
+        llvm::Function* function = drv.builder->GetInsertBlock()->getParent();
+        llvm::IRBuilder<> tmpBuilder(&function->getEntryBlock(), function->getEntryBlock().begin());
+        auto* allocaInstr = tmpBuilder.CreateAlloca(getType(drv), nullptr, drv.interner.name(this->name));
+        allocaInstr->setAlignment(align);
+        storage = allocaInstr;
     }
 
-    // restore original values
-    for (const auto& oldSymbol : oldSymbols)
+    // Un array appena creato vale tutto zero, a meno che ogni elemento sia
+    // sicuramente scritto prima della prima lettura
+    if (zeroInit)
     {
-        drv.symbolTable[oldSymbol.first] = oldSymbol.second;
+        drv.builder->CreateMemSet(storage, llvm::ConstantInt::get(llvm::Type::getInt8Ty(context), 0), arraySizeInBytes, align);
     }
 
-    return bodyVal;
+    return storage;
 }
 
-double NumberExprAST::getVal() const
+// La dichiarazione di un array riserva solo la memoria, non ha un valore proprio
+llvm::Value* ArrayInitExprAST::codegenValue(driver& drv)
 {
-    return this->Val;
+    throw std::runtime_error("La dichiarazione dell'array " + drv.interner.name(this->name).str() + " non ha un valore.");
 }
 
-ArrayInitExprAST::ArrayInitExprAST(const std::string& name, unsigned int capacity) :
-    name(name), capacity(capacity) {}
-
-const std::string& ArrayInitExprAST::getName() const { return this->name; }
+ArrayIndexingExprAST::ArrayIndexingExprAST(Symbol name, ExprAST* indexExpr) :
+    ExprAST(AK_ArrayIndexing), name(name), indexExpr(indexExpr) {}
 
-llvm::AllocaInst* ArrayInitExprAST::codegen(driver& drv)
+llvm::Value* ArrayIndexingExprAST::codegenValue(driver& drv)
 {
-    auto* arrayType = llvm::ArrayType::get(llvm::Type::getDoubleTy(*drv.context), this->capacity);
-    llvm::Value* arraySize = nullptr; // null because array size is already defined in arrayType
-    auto* allocaInstr = drv.builder->CreateAlloca(arrayType, arraySize, this->name);
-    unsigned int arraySizeInBytes = sizeof(double) * this->capacity;
-
-    // initialize array with all zero
-    drv.builder->CreateMemSet(allocaInstr, llvm::ConstantInt::get(llvm::Type::getInt8Ty(*drv.context), 0), arraySizeInBytes, allocaInstr->getAlign());
-
-    return allocaInstr;
+    return drv.builder->CreateLoad(llvm::Type::getDoubleTy(*drv.context), codegenAddress(drv));
 }
 
-ArrayIndexingExprAST::ArrayIndexingExprAST(const std::string& name, ExprAST* indexExpr) :
-    name(name), indexExpr(indexExpr) {}
-
-llvm::Value* ArrayIndexingExprAST::codegen(driver& drv)
+llvm::Value* ArrayIndexingExprAST::codegenAddress(driver& drv)
 {
-    auto* allocaInstr = drv.symbolTable.at(this->name);
+    Binding array = drv.symbolTable.lookup(this->name);
 
-    if (!allocaInstr)
+    if (!array.address || !array.type->isArrayTy())
     {
-        throw std::runtime_error("Array [" + this->name + "] has not been defined. Cannot access to it.");
+        throw std::runtime_error("Array [" + drv.interner.name(this->name).str() + "] has not been defined. Cannot access to it.");
     }
 
-    llvm::Value* indexExprResultAsDouble = indexExpr->codegen(drv);
-    llvm::Value* indexExprResultAsUInt = drv.builder->CreateFPToUI(indexExprResultAsDouble, llvm::Type::getInt32Ty(*drv.context));
-    llvm::Value* indexExprAs64Bit = drv.builder->CreateZExt(indexExprResultAsUInt, llvm::Type::getInt64Ty(*drv.context));
+    // Un indice intero viene usato come i64 senza passare per un double
+    bool integerIndex = currentIntegerRange(drv, indexExpr).has_value();
+    llvm::Value* index = integerIndex ? codegenInteger(drv, indexExpr) : indexExpr->codegenValue(drv);
+
+    // I parametri array non hanno una lunghezza nota con cui controllare
+    if (drv.boundsCheck && array.type->getArrayNumElements() != 0)
+    {
+        checkIndex(drv, this, indexExpr, index, array.type->getArrayNumElements());
+    }
+    llvm::Value* indexExprAs64Bit = index;
+
+    if (!integerIndex)
+    {
+        llvm::Value* indexExprResultAsUInt = drv.builder->CreateFPToUI(index, llvm::Type::getInt32Ty(*drv.context));
+        indexExprAs64Bit = drv.builder->CreateZExt(indexExprResultAsUInt, llvm::Type::getInt64Ty(*drv.context));
+    }
 
     std::vector<llvm::Value*> indexes = {
         llvm::ConstantInt::get(llvm::Type::getInt64Ty(*drv.context), 0),
         indexExprAs64Bit};
 
-    auto* gep = drv.builder->CreateInBoundsGEP(allocaInstr->getAllocatedType(), allocaInstr, indexes);
+    auto* gep = drv.builder->CreateInBoundsGEP(array.type, array.address, indexes);
 
     return gep;
 }
\ No newline at end of file
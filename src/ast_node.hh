@@ -1,46 +1,88 @@
 #ifndef AST_NODE_HH
 #define AST_NODE_HH
 
+#include "interner.hh"
+#include "loop_hints.hh"
+#include "param.hh"
 #include "operator.hh"
+#include <llvm/ADT/ArrayRef.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/Value.h>
+#include <llvm/Support/Casting.h>
+#include <llvm/Support/ErrorHandling.h>
 
 class driver;
 
 // Classe base dell'intera gerarchia di classi che rappresentano
-// gli elementi del programma
+// gli elementi del programma.
+// I nodi vivono nell'arena del driver (driver::make) e vengono rilasciati in
+// blocco: nessun distruttore viene mai eseguito, quindi i nodi contengono solo
+// puntatori, Symbol e ArrayRef verso memoria della stessa arena.
+// I nomi sono Symbol del driver (driver::interner).
+// Ogni nodo porta un tag con il proprio tipo: llvm::isa, llvm::cast e
+// llvm::dyn_cast lo usano al posto di dynamic_cast (vedi i classof).
 class RootAST
 {
   public:
-    virtual ~RootAST() = default;
-    virtual void visit(){};
-    virtual llvm::Value* codegen(driver&) = 0; // pure virtual function, subclasses are forced to provide an implementation
-};
+    enum ASTKind
+    {
+        AK_Prototype,
+        AK_Function,
+        AK_ExprFirst,
+        AK_Number = AK_ExprFirst,
+        AK_Variable,
+        AK_Binary,
+        AK_Unary,
+        AK_Call,
+        AK_If,
+        AK_For,
+        AK_While,
+        AK_Var,
+        AK_ArrayInit,
+        AK_ArrayIndexing,
+        AK_ExprLast = AK_ArrayIndexing
+    };
 
-// Classe che rappresenta la sequenza di statement
-class SeqAST : public RootAST
-{
   private:
-    RootAST* first;
-    RootAST* continuation;
+    const ASTKind kind;
+
+  protected:
+    RootAST(ASTKind kind) :
+        kind(kind) {}
 
   public:
-    SeqAST(RootAST* first, RootAST* continuation);
-    void visit() override;
-    llvm::Value* codegen(driver& drv) override;
+    ASTKind getKind() const { return kind; }
+    virtual void visit(const driver&){};
+    virtual llvm::Value* codegen(driver&) = 0; // pure virtual function, subclasses are forced to provide an implementation
 };
 
 /// ExprAST - Classe base per tutti i nodi espressione
+/// La generazione del codice ha due punti d'ingresso: codegenValue produce
+/// il valore (double) dell'espressione, codegenAddress l'indirizzo della
+/// locazione che l'espressione denota, ed esiste solo per i left value
+/// (variabili ed elementi di array).
 class ExprAST : public RootAST
 {
   protected:
-    bool top;
+    bool top = false;
+    ExprAST(ASTKind kind) :
+        RootAST(kind) {}
 
   public:
-    virtual ~ExprAST(){};
     void toggle();
     bool gettop();
+
+    // Le espressioni top-level vengono racchiuse in una funzione anonima,
+    // tutte le altre producono direttamente il proprio valore
+    llvm::Value* codegen(driver& drv) final;
+    virtual llvm::Value* codegenValue(driver& drv) = 0;
+    virtual llvm::Value* codegenAddress(driver& drv);
+
+    static bool classof(const RootAST* node)
+    {
+        return node->getKind() >= AK_ExprFirst && node->getKind() <= AK_ExprLast;
+    }
 };
 
 /// NumberExprAST - Classe per la rappresentazione di costanti numeriche
@@ -54,21 +96,26 @@ class NumberExprAST : public ExprAST
 
     double getVal() const;
 
-    void visit() override;
-    llvm::Value* codegen(driver& drv) override;
+    void visit(const driver&) override;
+    llvm::Value* codegenValue(driver& drv) override;
+
+    static bool classof(const RootAST* node) { return node->getKind() == AK_Number; }
 };
 
 /// VariableExprAST - Classe per la rappresentazione di riferimenti a variabili
 class VariableExprAST : public ExprAST
 {
   private:
-    std::string varName;
+    Symbol varName;
 
   public:
-    VariableExprAST(std::string& Name);
-    const std::string& getName() const;
-    void visit() override;
-    llvm::Value* codegen(driver& drv) override;
+    VariableExprAST(Symbol Name);
+    Symbol getName() const;
+    void visit(const driver&) override;
+    llvm::Value* codegenValue(driver& drv) override;
+    llvm::Value* codegenAddress(driver& drv) override;
+
+    static bool classof(const RootAST* node) { return node->getKind() == AK_Variable; }
 };
 
 /// BinaryExprAST - Classe per la rappresentazione di operatori binary
@@ -81,8 +128,13 @@ class BinaryExprAST : public ExprAST
 
   public:
     BinaryExprAST(Operator Op, ExprAST* LHS, ExprAST* RHS);
-    void visit() override;
-    llvm::Value* codegen(driver& drv) override;
+    Operator getOp() const { return Op; }
+    ExprAST*& getLHS() { return LHS; }
+    ExprAST*& getRHS() { return RHS; }
+    void visit(const driver&) override;
+    llvm::Value* codegenValue(driver& drv) override;
+
+    static bool classof(const RootAST* node) { return node->getKind() == AK_Binary; }
 };
 
 class UnaryExprAST : public ExprAST
@@ -93,21 +145,41 @@ class UnaryExprAST : public ExprAST
 
   public:
     UnaryExprAST(const Operator&, ExprAST*);
+    Operator getOp() const { return op; }
+    ExprAST*& getOperand() { return operand; }
+
+    llvm::Value* codegenValue(driver&) override;
 
-    llvm::Value* codegen(driver&) override;
+    static bool classof(const RootAST* node) { return node->getKind() == AK_Unary; }
+};
+
+// Posizione di una chiamata rispetto al valore restituito dalla funzione
+// che la contiene (vedi markTailCalls)
+enum class TailCall : uint8_t
+{
+    None, // Il risultato viene ancora usato dopo la chiamata
+    Tail, // Il risultato è quello della funzione (es. in un ramo di un if)
+    MustTail // Come Tail, e la chiamata è seguita direttamente dal ret
 };
 
 /// CallExprAST - Classe per la rappresentazione di chiamate di funzione
 class CallExprAST : public ExprAST
 {
   private:
-    std::string Callee;
-    std::vector<ExprAST*> Args; // ASTs per la valutazione degli argomenti
+    Symbol Callee;
+    llvm::MutableArrayRef<ExprAST*> Args; // ASTs per la valutazione degli argomenti
+    TailCall tail = TailCall::None;
 
   public:
-    CallExprAST(std::string Callee, std::vector<ExprAST*> Args);
-    void visit() override;
-    llvm::Value* codegen(driver& drv) override;
+    CallExprAST(Symbol Callee, llvm::MutableArrayRef<ExprAST*> Args);
+    Symbol getCallee() const { return Callee; }
+    llvm::MutableArrayRef<ExprAST*> getArgs() { return Args; }
+    TailCall getTail() const { return tail; }
+    void setTail(TailCall kind) { tail = kind; }
+    void visit(const driver&) override;
+    llvm::Value* codegenValue(driver& drv) override;
+
+    static bool classof(const RootAST* node) { return node->getKind() == AK_Call; }
 };
 
 /// PrototypeAST - Classe per la rappresentazione dei prototipi di funzione
@@ -116,18 +188,20 @@ class CallExprAST : public ExprAST
 class PrototypeAST : public RootAST
 {
   private:
-    std::string Name;
-    std::vector<std::string> Args;
+    Symbol Name;
+    llvm::ArrayRef<Param> Args;
     bool emit;
 
   public:
-    PrototypeAST(std::string Name, std::vector<std::string> Args);
-    const std::string& getName() const;
-    const std::vector<std::string>& getArgs() const;
-    void visit() override;
+    PrototypeAST(Symbol Name, llvm::ArrayRef<Param> Args);
+    Symbol getName() const;
+    llvm::ArrayRef<Param> getArgs() const;
+    void visit(const driver&) override;
     llvm::Function* codegen(driver& drv) override;
     void noemit();
     bool emitp();
+
+    static bool classof(const RootAST* node) { return node->getKind() == AK_Prototype; }
 };
 
 /// FunctionAST - Classe che rappresenta la definizione di una funzione
@@ -137,11 +211,17 @@ class FunctionAST : public RootAST
     PrototypeAST* Proto;
     ExprAST* Body;
     bool external;
+    bool fast; // Definita con "def fast": tutti i flag fast-math
 
   public:
-    FunctionAST(PrototypeAST* Proto, ExprAST* Body);
-    void visit() override;
+    FunctionAST(PrototypeAST* Proto, ExprAST* Body, bool fast = false);
+    PrototypeAST* getProto() { return Proto; }
+    bool isFast() const { return fast; }
+    ExprAST*& getBody() { return Body; }
+    void visit(const driver&) override;
     llvm::Function* codegen(driver& drv) override;
+
+    static bool classof(const RootAST* node) { return node->getKind() == AK_Function; }
 };
 
 class IfExprNode : public ExprAST
@@ -153,24 +233,41 @@ class IfExprNode : public ExprAST
 
   public:
     IfExprNode(ExprAST*, ExprAST*, ExprAST*);
+    ExprAST*& getCondition() { return conditionExpr; }
+    ExprAST*& getThen() { return thenExpr; }
+    ExprAST*& getElse() { return elseExpr; } // nullptr se manca il ramo else
 
-    void visit() override;
+    void visit(const driver&) override;
 
-    llvm::Value* codegen(driver& drv) override;
+    llvm::Value* codegenValue(driver& drv) override;
+
+    static bool classof(const RootAST* node) { return node->getKind() == AK_If; }
 };
 
 class ForExprAST : public ExprAST
 {
   private:
-    std::string varName;
+    Symbol varName;
     ExprAST* start;
     ExprAST* end;
     ExprAST* step;
     ExprAST* body;
+    LoopHints hints;
+    bool integerInduction = false; // Contatore tenuto in un i64 (vedi inferIntegers)
 
   public:
-    ForExprAST(const std::string&, ExprAST*, ExprAST*, ExprAST*, ExprAST*);
-    llvm::Value* codegen(driver&) override;
+    ForExprAST(Symbol, ExprAST*, ExprAST*, ExprAST*, ExprAST*, LoopHints);
+    Symbol getVarName() const { return varName; }
+    bool hasIntegerInduction() const { return integerInduction; }
+    void setIntegerInduction() { integerInduction = true; }
+    ExprAST*& getStart() { return start; }
+    ExprAST*& getEnd() { return end; }
+    ExprAST*& getStep() { return step; } // nullptr se il passo è implicito (1)
+    ExprAST*& getBody() { return body; }
+    const LoopHints& getHints() const { return hints; }
+    llvm::Value* codegenValue(driver&) override;
+
+    static bool classof(const RootAST* node) { return node->getKind() == AK_For; }
 };
 
 class WhileExprAST : public ExprAST
@@ -178,45 +275,216 @@ class WhileExprAST : public ExprAST
   private:
     ExprAST* condition;
     ExprAST* body;
+    LoopHints hints;
 
   public:
-    WhileExprAST(ExprAST*, ExprAST*);
-    llvm::Value* codegen(driver&) override;
+    WhileExprAST(ExprAST*, ExprAST*, LoopHints);
+    ExprAST*& getCondition() { return condition; }
+    ExprAST*& getBody() { return body; }
+    const LoopHints& getHints() const { return hints; }
+    llvm::Value* codegenValue(driver&) override;
+
+    static bool classof(const RootAST* node) { return node->getKind() == AK_While; }
 };
 
 class VarExprAST : public ExprAST
 {
   private:
-    std::vector<std::pair<std::string, ExprAST*>> varNames;
+    llvm::MutableArrayRef<std::pair<Symbol, ExprAST*>> varNames;
     ExprAST* body;
+    uint64_t integerVars = 0; // Bit i: varNames[i] è tenuta in un i64 (vedi inferIntegers)
 
   public:
-    VarExprAST(std::vector<std::pair<std::string, ExprAST*>>, ExprAST*);
-    llvm::Value* codegen(driver&) override;
+    VarExprAST(llvm::MutableArrayRef<std::pair<Symbol, ExprAST*>>, ExprAST*);
+    llvm::MutableArrayRef<std::pair<Symbol, ExprAST*>> getVarNames() { return varNames; }
+    bool isInteger(unsigned i) const { return i < 64 && (integerVars >> i & 1); }
+    void setInteger(unsigned i)
+    {
+        if (i < 64)
+            integerVars |= uint64_t(1) << i;
+    }
+    ExprAST*& getBody() { return body; }
+    llvm::Value* codegenValue(driver&) override;
+
+    static bool classof(const RootAST* node) { return node->getKind() == AK_Var; }
 };
 
+/// ArrayInitExprAST - Dichiarazione di un array in un blocco var: non ha un
+/// valore, alloca la memoria dell'array (allocate). Gli array piccoli stanno
+/// in un'alloca del blocco entry, quelli oltre driver::stackArrayLimit sullo
+/// heap e vengono liberati all'uscita dal blocco var.
 class ArrayInitExprAST : public ExprAST
 {
   private:
-    std::string name;
+    Symbol name;
     unsigned int capacity;
 
   public:
-    const std::string& getName() const;
+    Symbol getName() const;
+    unsigned int getCapacity() const { return capacity; }
 
-    ArrayInitExprAST(const std::string&, unsigned int);
-    llvm::AllocaInst* codegen(driver&) override;
+    ArrayInitExprAST(Symbol, unsigned int);
+    llvm::ArrayType* getType(driver&) const;
+    bool onHeap(const driver&) const;
+    llvm::Value* allocate(driver&, bool zeroInit);
+    llvm::Value* codegenValue(driver&) override;
+
+    static bool classof(const RootAST* node) { return node->getKind() == AK_ArrayInit; }
 };
 
 class ArrayIndexingExprAST : public ExprAST
 {
   private:
-    std::string name;
+    Symbol name;
     ExprAST* indexExpr;
 
   public:
-    ArrayIndexingExprAST(const std::string&, ExprAST* indexExpr);
-    llvm::Value* codegen(driver&) override;
+    ArrayIndexingExprAST(Symbol, ExprAST* indexExpr);
+    Symbol getName() const { return name; }
+    ExprAST*& getIndex() { return indexExpr; }
+    llvm::Value* codegenValue(driver&) override;
+    llvm::Value* codegenAddress(driver&) override;
+
+    static bool classof(const RootAST* node) { return node->getKind() == AK_ArrayIndexing; }
+};
+
+/*************************** Visite dell'AST ***************************/
+
+// Applica f a ogni figlio non nullo di node. I figli sono passati per
+// riferimento (ExprAST*&), così una passata può sostituirli sul posto.
+template <typename F>
+void forEachChild(RootAST* node, F&& f)
+{
+    auto apply = [&f](ExprAST*& child) {
+        if (child)
+            f(child);
+    };
+
+    switch (node->getKind())
+    {
+        case RootAST::AK_Prototype:
+        case RootAST::AK_Number:
+        case RootAST::AK_Variable:
+        case RootAST::AK_ArrayInit:
+            return;
+        case RootAST::AK_Function:
+            return apply(llvm::cast<FunctionAST>(node)->getBody());
+        case RootAST::AK_Binary:
+        {
+            auto* binary = llvm::cast<BinaryExprAST>(node);
+            apply(binary->getLHS());
+            return apply(binary->getRHS());
+        }
+        case RootAST::AK_Unary:
+            return apply(llvm::cast<UnaryExprAST>(node)->getOperand());
+        case RootAST::AK_Call:
+            for (ExprAST*& arg : llvm::cast<CallExprAST>(node)->getArgs())
+                apply(arg);
+            return;
+        case RootAST::AK_If:
+        {
+            auto* ifExpr = llvm::cast<IfExprNode>(node);
+            apply(ifExpr->getCondition());
+            apply(ifExpr->getThen());
+            return apply(ifExpr->getElse());
+        }
+        case RootAST::AK_For:
+        {
+            auto* forExpr = llvm::cast<ForExprAST>(node);
+            apply(forExpr->getStart());
+            apply(forExpr->getEnd());
+            apply(forExpr->getStep());
+            return apply(forExpr->getBody());
+        }
+        case RootAST::AK_While:
+        {
+            auto* whileExpr = llvm::cast<WhileExprAST>(node);
+            apply(whileExpr->getCondition());
+            return apply(whileExpr->getBody());
+        }
+        case RootAST::AK_Var:
+        {
+            auto* varExpr = llvm::cast<VarExprAST>(node);
+            for (auto& binding : varExpr->getVarNames())
+                apply(binding.second);
+            return apply(varExpr->getBody());
+        }
+        case RootAST::AK_ArrayIndexing:
+            return apply(llvm::cast<ArrayIndexingExprAST>(node)->getIndex());
+    }
+    llvm_unreachable("unknown AST kind");
+}
+
+// Vero se valutare l'espressione non ha effetti oltre al suo valore
+// (niente assegnamenti, chiamate, cicli o blocchi var)
+bool isPure(ExprAST* expr);
+
+// Prosegue in un nuovo blocco se inRange è vero, altrimenti termina il
+// programma (controllo degli indici con -fbounds-check, allocazione degli
+// array sullo heap)
+void branchToTrapUnless(driver& drv, llvm::Value* inRange, llvm::StringRef name);
+
+// Visitatore CRTP: visit() smista sul tag del nodo, senza chiamate virtuali
+// né RTTI, verso il metodo visitXxx della classe derivata. Una passata
+// ridefinisce solo i nodi che le interessano; gli altri ricadono su
+// visitExpr e infine su visitRoot, che di default restituisce RetTy().
+// Per scendere nei figli si usa forEachChild.
+template <typename Derived, typename RetTy = void>
+class ASTVisitor
+{
+  public:
+    RetTy visit(RootAST* node)
+    {
+        switch (node->getKind())
+        {
+            case RootAST::AK_Prototype:
+                return derived().visitPrototype(llvm::cast<PrototypeAST>(node));
+            case RootAST::AK_Function:
+                return derived().visitFunction(llvm::cast<FunctionAST>(node));
+            case RootAST::AK_Number:
+                return derived().visitNumber(llvm::cast<NumberExprAST>(node));
+            case RootAST::AK_Variable:
+                return derived().visitVariable(llvm::cast<VariableExprAST>(node));
+            case RootAST::AK_Binary:
+                return derived().visitBinary(llvm::cast<BinaryExprAST>(node));
+            case RootAST::AK_Unary:
+                return derived().visitUnary(llvm::cast<UnaryExprAST>(node));
+            case RootAST::AK_Call:
+                return derived().visitCall(llvm::cast<CallExprAST>(node));
+            case RootAST::AK_If:
+                return derived().visitIf(llvm::cast<IfExprNode>(node));
+            case RootAST::AK_For:
+                return derived().visitFor(llvm::cast<ForExprAST>(node));
+            case RootAST::AK_While:
+                return derived().visitWhile(llvm::cast<WhileExprAST>(node));
+            case RootAST::AK_Var:
+                return derived().visitVar(llvm::cast<VarExprAST>(node));
+            case RootAST::AK_ArrayInit:
+                return derived().visitArrayInit(llvm::cast<ArrayInitExprAST>(node));
+            case RootAST::AK_ArrayIndexing:
+                return derived().visitArrayIndexing(llvm::cast<ArrayIndexingExprAST>(node));
+        }
+        llvm_unreachable("unknown AST kind");
+    }
+
+    RetTy visitPrototype(PrototypeAST* node) { return derived().visitRoot(node); }
+    RetTy visitFunction(FunctionAST* node) { return derived().visitRoot(node); }
+    RetTy visitNumber(NumberExprAST* node) { return derived().visitExpr(node); }
+    RetTy visitVariable(VariableExprAST* node) { return derived().visitExpr(node); }
+    RetTy visitBinary(BinaryExprAST* node) { return derived().visitExpr(node); }
+    RetTy visitUnary(UnaryExprAST* node) { return derived().visitExpr(node); }
+    RetTy visitCall(CallExprAST* node) { return derived().visitExpr(node); }
+    RetTy visitIf(IfExprNode* node) { return derived().visitExpr(node); }
+    RetTy visitFor(ForExprAST* node) { return derived().visitExpr(node); }
+    RetTy visitWhile(WhileExprAST* node) { return derived().visitExpr(node); }
+    RetTy visitVar(VarExprAST* node) { return derived().visitExpr(node); }
+    RetTy visitArrayInit(ArrayInitExprAST* node) { return derived().visitExpr(node); }
+    RetTy visitArrayIndexing(ArrayIndexingExprAST* node) { return derived().visitExpr(node); }
+    RetTy visitExpr(ExprAST* node) { return derived().visitRoot(node); }
+    RetTy visitRoot(RootAST*) { return RetTy(); }
+
+  private:
+    Derived& derived() { return static_cast<Derived&>(*this); }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,325 @@
+#include "builtins.hh"
+#include "ast_node.hh"
+#include "driver.hh"
+#include <llvm/ADT/STLFunctionalExtras.h>
+#include <llvm/ADT/StringSwitch.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Intrinsics.h>
+#include <llvm/IR/Metadata.h>
+#include <llvm/Support/Alignment.h>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <string>
+
+enum class Builtin
+{
+    None,
+    Sum,
+    Dot,
+    Min,
+    Max,
+    Axpy
+};
+
+// Quattro double riempiono un registro AVX; i target più stretti dividono il vettore
+constexpr unsigned VectorWidth = 4;
+
+static Builtin builtinKind(const driver& drv, CallExprAST* call)
+{
+    llvm::StringRef name = drv.interner.name(call->getCallee());
+
+    // Una funzione dell'utente con lo stesso nome ha la precedenza
+    if (drv.module->getFunction(name) || drv.knownFunctions.count(name))
+        return Builtin::None;
+
+    return llvm::StringSwitch<Builtin>(name)
+        .Case("sum", Builtin::Sum)
+        .Case("dot", Builtin::Dot)
+        .Case("min", Builtin::Min)
+        .Case("max", Builtin::Max)
+        .Case("axpy", Builtin::Axpy)
+        .Default(Builtin::None);
+}
+
+bool isBuiltinCall(const driver& drv, CallExprAST* call)
+{
+    return builtinKind(drv, call) != Builtin::None;
+}
+
+Binding arrayArgument(const driver& drv, ExprAST* arg)
+{
+    auto* variable = llvm::dyn_cast<VariableExprAST>(arg);
+    Binding binding = variable ? drv.symbolTable.lookup(variable->getName()) : Binding();
+
+    if (!binding.address || !binding.type->isArrayTy())
+        return Binding();
+    return binding;
+}
+
+// Marca un ciclo già vettorizzato dal builtin, così il loop vectorizer lo
+// lascia com'è
+static llvm::MDNode* vectorizedLoopMetadata(driver& drv)
+{
+    llvm::LLVMContext& context = *drv.context;
+    llvm::Metadata* isVectorized[] = {llvm::MDString::get(context, "llvm.loop.isvectorized"),
+                                      llvm::ConstantAsMetadata::get(llvm::ConstantInt::get(llvm::Type::getInt32Ty(context), 1))};
+    llvm::Metadata* operands[] = {nullptr, llvm::MDNode::get(context, isVectorized)};
+
+    llvm::MDNode* loopID = llvm::MDNode::getDistinct(context, operands);
+    loopID->replaceOperandWith(0, loopID);
+    return loopID;
+}
+
+// Emette  for (i = from; i < to; i += stride) acc = body(i, acc)  e
+// restituisce l'accumulatore finale, che è init se il ciclo non viene
+// eseguito. I cicli che scrivono soltanto passano un init nullo e ricevono
+// un risultato nullo.
+static llvm::Value* emitCountedLoop(driver& drv, llvm::Value* from, llvm::Value* to, uint64_t stride, llvm::Value* init,
+                                    llvm::function_ref<llvm::Value*(llvm::Value*, llvm::Value*)> body, llvm::StringRef name)
+{
+    llvm::IRBuilder<>& builder = *drv.builder;
+    llvm::Function* function = builder.GetInsertBlock()->getParent();
+    llvm::BasicBlock* preheader = builder.GetInsertBlock();
+    llvm::BasicBlock* loop = llvm::BasicBlock::Create(*drv.context, name, function);
+    llvm::BasicBlock* exit = llvm::BasicBlock::Create(*drv.context, name + "exit", function);
+
+    builder.CreateCondBr(builder.CreateICmpULT(from, to), loop, exit);
+
+    builder.SetInsertPoint(loop);
+    llvm::PHINode* index = builder.CreatePHI(builder.getInt64Ty(), 2, name + ".i");
+    index->addIncoming(from, preheader);
+    llvm::PHINode* acc = nullptr;
+    if (init)
+    {
+        acc = builder.CreatePHI(init->getType(), 2, name + ".acc");
+        acc->addIncoming(init, preheader);
+    }
+
+    llvm::Value* next = body(index, acc);
+    llvm::Value* nextIndex = builder.CreateAdd(index, builder.getInt64(stride), name + ".next", /*HasNUW=*/true);
+    llvm::BasicBlock* latch = builder.GetInsertBlock();
+    index->addIncoming(nextIndex, latch);
+    if (acc)
+        acc->addIncoming(next, latch);
+    llvm::BranchInst* backedge = builder.CreateCondBr(builder.CreateICmpULT(nextIndex, to), loop, exit);
+    backedge->setMetadata(llvm::LLVMContext::MD_loop, vectorizedLoopMetadata(drv));
+
+    builder.SetInsertPoint(exit);
+    if (!acc)
+        return nullptr;
+
+    llvm::PHINode* result = builder.CreatePHI(init->getType(), 2, name + ".result");
+    result->addIncoming(init, preheader);
+    result->addIncoming(next, latch);
+    return result;
+}
+
+// Carica l'elemento dell'array in posizione index, o i VectorWidth elementi
+// che partono da lì se type è un vettore. Gli array locali sono allocati
+// con drv.arrayAlign e il ciclo vettoriale visita solo multipli della
+// larghezza; degli array ricevuti come parametri non si sa nulla.
+static llvm::Value* loadElements(driver& drv, const Binding& array, llvm::Value* index, llvm::Type* type)
+{
+    llvm::IRBuilder<>& builder = *drv.builder;
+    uint64_t alignment = sizeof(double);
+
+    if (type->isVectorTy() && array.type->getArrayNumElements() != 0)
+        alignment = std::min<uint64_t>(drv.arrayAlign, VectorWidth * sizeof(double));
+
+    llvm::Value* address = builder.CreateInBoundsGEP(builder.getDoubleTy(), array.address, index);
+    return builder.CreateAlignedLoad(type, address, llvm::Align(alignment));
+}
+
+static void storeElements(driver& drv, const Binding& array, llvm::Value* index, llvm::Value* value)
+{
+    llvm::IRBuilder<>& builder = *drv.builder;
+    uint64_t alignment = sizeof(double);
+
+    if (value->getType()->isVectorTy() && array.type->getArrayNumElements() != 0)
+        alignment = std::min<uint64_t>(drv.arrayAlign, VectorWidth * sizeof(double));
+
+    llvm::Value* address = builder.CreateInBoundsGEP(builder.getDoubleTy(), array.address, index);
+    builder.CreateAlignedStore(value, address, llvm::Align(alignment));
+}
+
+// Numero di elementi dall'argomento double: i valori minori di 1, e NaN,
+// danno un intervallo vuoto
+static llvm::Value* elementCount(driver& drv, llvm::Value* n)
+{
+    llvm::IRBuilder<>& builder = *drv.builder;
+    llvm::Value* nonEmpty = builder.CreateFCmpOGE(n, llvm::ConstantFP::get(builder.getDoubleTy(), 1.0));
+    llvm::Value* count = builder.CreateFPToUI(n, builder.getInt64Ty());
+    return builder.CreateSelect(nonEmpty, count, builder.getInt64(0), "count");
+}
+
+// Con -fbounds-check, n non deve superare la lunghezza di un array locale
+static void checkCount(driver& drv, const Binding& array, ExprAST* countExpr, llvm::Value* n)
+{
+    uint64_t capacity = array.type->getArrayNumElements();
+
+    if (!drv.boundsCheck || capacity == 0)
+        return;
+
+    if (auto* number = llvm::dyn_cast<NumberExprAST>(countExpr); number && number->getVal() <= double(capacity))
+    {
+        ++drv.boundsChecksEliminated;
+        return;
+    }
+
+    llvm::Value* inRange = drv.builder->CreateFCmpOLE(n, llvm::ConstantFP::get(drv.builder->getDoubleTy(), double(capacity)), "countinbounds");
+    branchToTrapUnless(drv, inRange, "countok");
+    ++drv.boundsChecksEmitted;
+}
+
+// Ciclo vettoriale sul più grande multiplo di VectorWidth elementi,
+// riduzione orizzontale dell'accumulatore vettoriale, poi un ciclo scalare
+// sul resto. step combina nell'accumulatore gli elementi all'indice,
+// caricati con il tipo indicato (il vettore o double).
+static llvm::Value* emitReduction(driver& drv, llvm::Value* count, double identity,
+                                  llvm::function_ref<llvm::Value*(llvm::Value*, llvm::Value*, llvm::Type*)> step,
+                                  llvm::function_ref<llvm::Value*(llvm::Value*)> reduce)
+{
+    llvm::IRBuilder<>& builder = *drv.builder;
+    llvm::Type* doubleTy = builder.getDoubleTy();
+    llvm::Type* vectorTy = llvm::FixedVectorType::get(doubleTy, VectorWidth);
+    llvm::Value* vectorEnd = builder.CreateAnd(count, ~uint64_t(VectorWidth - 1), "vectorend");
+
+    llvm::Value* partial = emitCountedLoop(
+        drv, builder.getInt64(0), vectorEnd, VectorWidth, llvm::ConstantFP::get(vectorTy, identity),
+        [&](llvm::Value* index, llvm::Value* acc) { return step(index, acc, vectorTy); }, "vector");
+
+    return emitCountedLoop(
+        drv, vectorEnd, count, 1, reduce(partial),
+        [&](llvm::Value* index, llvm::Value* acc) { return step(index, acc, doubleTy); }, "remainder");
+}
+
+llvm::Value* emitBuiltinCall(driver& drv, CallExprAST* call)
+{
+    Builtin kind = builtinKind(drv, call);
+    llvm::StringRef name = drv.interner.name(call->getCallee());
+    llvm::MutableArrayRef<ExprAST*> args = call->getArgs();
+
+    // Posizione di ogni argomento array; gli altri sono scalari, e il
+    // numero di elementi è sempre l'ultimo
+    llvm::SmallVector<unsigned, 2> arrayPositions;
+    unsigned arity = 0;
+    switch (kind)
+    {
+        case Builtin::Sum:
+        case Builtin::Min:
+        case Builtin::Max:
+            arrayPositions = {0};
+            arity = 2;
+            break;
+        case Builtin::Dot:
+            arrayPositions = {0, 1};
+            arity = 3;
+            break;
+        case Builtin::Axpy:
+            arrayPositions = {1, 2};
+            arity = 4;
+            break;
+        case Builtin::None:
+            llvm_unreachable("not a builtin call");
+    }
+
+    if (args.size() != arity)
+        throw std::runtime_error(name.str() + " richiede " + std::to_string(arity) + " argomenti");
+
+    llvm::SmallVector<Binding, 2> arrays;
+    for (unsigned position : arrayPositions)
+    {
+        arrays.push_back(arrayArgument(drv, args[position]));
+        if (!arrays.back().address)
+            throw std::runtime_error("L'argomento " + std::to_string(position + 1) + " di " + name.str() + " deve essere un array");
+    }
+
+    llvm::IRBuilder<>& builder = *drv.builder;
+    llvm::Value* alpha = kind == Builtin::Axpy ? args[0]->codegenValue(drv) : nullptr;
+    llvm::Value* n = args.back()->codegenValue(drv);
+    if (!n || (kind == Builtin::Axpy && !alpha))
+        return nullptr;
+
+    for (const Binding& array : arrays)
+        checkCount(drv, array, args.back(), n);
+
+    // È la riassociazione a rendere lecito il ciclo vettoriale: viene
+    // permessa solo alle operazioni del builtin, oltre ai flag della funzione
+    llvm::IRBuilder<>::FastMathFlagGuard guard(builder);
+    llvm::FastMathFlags flags = builder.getFastMathFlags();
+    flags.setAllowReassoc();
+    builder.setFastMathFlags(flags);
+
+    llvm::Value* count = elementCount(drv, n);
+    llvm::Value* negativeZero = llvm::ConstantFP::getNegativeZero(builder.getDoubleTy());
+
+    switch (kind)
+    {
+        case Builtin::Sum:
+            return emitReduction(
+                drv, count, -0.0,
+                [&](llvm::Value* index, llvm::Value* acc, llvm::Type* type) {
+                    return builder.CreateFAdd(acc, loadElements(drv, arrays[0], index, type));
+                },
+                [&](llvm::Value* vector) { return builder.CreateFAddReduce(negativeZero, vector); });
+        case Builtin::Dot:
+            return emitReduction(
+                drv, count, -0.0,
+                [&](llvm::Value* index, llvm::Value* acc, llvm::Type* type) {
+                    llvm::Value* a = loadElements(drv, arrays[0], index, type);
+                    llvm::Value* b = loadElements(drv, arrays[1], index, type);
+                    return builder.CreateIntrinsic(llvm::Intrinsic::fmuladd, {type}, {a, b, acc});
+                },
+                [&](llvm::Value* vector) { return builder.CreateFAddReduce(negativeZero, vector); });
+        case Builtin::Min:
+            return emitReduction(
+                drv, count, INFINITY,
+                [&](llvm::Value* index, llvm::Value* acc, llvm::Type* type) {
+                    return builder.CreateMinNum(acc, loadElements(drv, arrays[0], index, type));
+                },
+                [&](llvm::Value* vector) { return builder.CreateFPMinReduce(vector); });
+        case Builtin::Max:
+            return emitReduction(
+                drv, count, -INFINITY,
+                [&](llvm::Value* index, llvm::Value* acc, llvm::Type* type) {
+                    return builder.CreateMaxNum(acc, loadElements(drv, arrays[0], index, type));
+                },
+                [&](llvm::Value* vector) { return builder.CreateFPMaxReduce(vector); });
+        case Builtin::Axpy:
+        {
+            // x e y sono lo stesso array o sono disgiunti, quindi caricare
+            // un vettore intero di entrambi prima di scrivere y è sicuro
+            llvm::Value* vectorEnd = builder.CreateAnd(count, ~uint64_t(VectorWidth - 1), "vectorend");
+            llvm::Value* alphaVector = builder.CreateVectorSplat(VectorWidth, alpha, "alpha");
+            auto step = [&](llvm::Value* index, llvm::Value* scale) {
+                llvm::Type* type = scale->getType();
+                llvm::Value* x = loadElements(drv, arrays[0], index, type);
+                llvm::Value* y = loadElements(drv, arrays[1], index, type);
+                storeElements(drv, arrays[1], index, builder.CreateIntrinsic(llvm::Intrinsic::fmuladd, {type}, {scale, x, y}));
+            };
+
+            emitCountedLoop(
+                drv, builder.getInt64(0), vectorEnd, VectorWidth, nullptr,
+                [&](llvm::Value* index, llvm::Value*) -> llvm::Value* {
+                    step(index, alphaVector);
+                    return nullptr;
+                },
+                "vector");
+            emitCountedLoop(
+                drv, vectorEnd, count, 1, nullptr,
+                [&](llvm::Value* index, llvm::Value*) -> llvm::Value* {
+                    step(index, alpha);
+                    return nullptr;
+                },
+                "remainder");
+            return llvm::Constant::getNullValue(builder.getDoubleTy());
+        }
+        case Builtin::None:
+            break;
+    }
+    llvm_unreachable("not a builtin call");
+}
@@ -0,0 +1,27 @@
+#ifndef BUILTINS_HH
+#define BUILTINS_HH
+
+#include "symbol_table.hh"
+#include <llvm/IR/Value.h>
+
+class driver;
+class ExprAST;
+class CallExprAST;
+
+// Funzioni predefinite sugli array, generate in linea come cicli vettoriali
+// espliciti seguiti da un ciclo scalare per gli elementi rimanenti:
+//   sum(a, n)             somma dei primi n elementi di a
+//   dot(a, b, n)          prodotto scalare dei primi n elementi di a e b
+//   min(a, n), max(a, n)  minimo e massimo dei primi n elementi di a
+//   axpy(alpha, x, y, n)  y[i] = alpha * x[i] + y[i] per i < n (vale 0)
+// Le operazioni al loro interno possono essere riassociate, a differenza del
+// resto del programma. Un nome è predefinito solo se il modulo non contiene
+// una funzione con lo stesso nome.
+bool isBuiltinCall(const driver& drv, CallExprAST* call);
+llvm::Value* emitBuiltinCall(driver& drv, CallExprAST* call);
+
+// Binding dell'array passato come argomento di una chiamata; vuoto se
+// l'argomento non è il nome di un array visibile
+Binding arrayArgument(const driver& drv, ExprAST* arg);
+
+#endif
@@ -0,0 +1,60 @@
+#include "compile_stats.hh"
+#include <sys/resource.h>
+#include <cstdlib>
+#include <new>
+
+// Contate per thread, così le compilazioni parallele riportano le proprie
+// fasi e il contatore non ha bisogno di operazioni atomiche
+static thread_local uint64_t allocations = 0;
+
+static bool phaseMemoryTracking = false;
+
+// Sostituiscono le funzioni di allocazione globali. Le forme array e
+// nothrow chiamano queste, quindi ogni allocazione con new viene contata.
+void* operator new(std::size_t size)
+{
+    ++allocations;
+    if (void* memory = std::malloc(size ? size : 1))
+        return memory;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
+uint64_t allocationCount()
+{
+    return allocations;
+}
+
+uint64_t peakRSSKilobytes()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    return uint64_t(usage.ru_maxrss); // già in KiB su Linux
+}
+
+void setPhaseMemoryTracking(bool enabled)
+{
+    phaseMemoryTracking = enabled;
+}
+
+Phase::Phase(PhaseStats& stats, llvm::StringRef name, llvm::StringRef detail) :
+    trace(name, detail), stats(stats), start(std::chrono::steady_clock::now()), startAllocations(allocations),
+    startPeakRSS(phaseMemoryTracking ? peakRSSKilobytes() : 0) {}
+
+Phase::~Phase()
+{
+    stats.time += std::chrono::steady_clock::now() - start;
+    stats.allocations += allocations - startAllocations;
+    if (phaseMemoryTracking)
+        stats.peakRSSGrowth += peakRSSKilobytes() - startPeakRSS;
+}
@@ -0,0 +1,66 @@
+#ifndef COMPILE_STATS_HH
+#define COMPILE_STATS_HH
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/TimeProfiler.h>
+#include <chrono>
+#include <cstdint>
+
+// Allocazioni con operator new fatte finora dal thread corrente
+uint64_t allocationCount();
+
+// Picco della memoria residente del processo, in KiB
+uint64_t peakRSSKilobytes();
+
+// Con -stats ogni fase misura anche la memoria residente, leggendo il picco
+// del processo all'inizio e alla fine (due chiamate a getrusage per fase)
+void setPhaseMemoryTracking(bool enabled);
+
+// Tempo, allocazioni e memoria accumulati da una fase della compilazione (-stats)
+struct PhaseStats
+{
+    std::chrono::duration<double, std::milli> time{};
+    uint64_t allocations = 0;
+    // KiB di cui è cresciuto il picco RSS del processo mentre la fase era in
+    // corso: indica quali fasi determinano il picco. Con -j la memoria è
+    // condivisa dai thread e la crescita viene attribuita a tutte le fasi in
+    // corso in quel momento.
+    uint64_t peakRSSGrowth = 0;
+
+    PhaseStats& operator+=(const PhaseStats& other)
+    {
+        time += other.time;
+        allocations += other.allocations;
+        peakRSSGrowth += other.peakRSSGrowth;
+        return *this;
+    }
+
+    PhaseStats& operator-=(const PhaseStats& other)
+    {
+        time -= other.time;
+        allocations -= other.allocations;
+        peakRSSGrowth -= other.peakRSSGrowth;
+        return *this;
+    }
+};
+
+// Una fase in corso: è uno span di -ftime-trace (se attivo) e alla fine
+// aggiunge a stats tempo e allocazioni del thread corrente e la crescita
+// del picco RSS
+class Phase
+{
+  private:
+    llvm::TimeTraceScope trace;
+    PhaseStats& stats;
+    std::chrono::steady_clock::time_point start;
+    uint64_t startAllocations;
+    uint64_t startPeakRSS;
+
+  public:
+    Phase(PhaseStats& stats, llvm::StringRef name, llvm::StringRef detail = "");
+    ~Phase();
+    Phase(const Phase&) = delete;
+    Phase& operator=(const Phase&) = delete;
+};
+
+#endif
@@ -0,0 +1,261 @@
+#include "constant_folding.hh"
+#include "ast_node.hh"
+#include "driver.hh"
+#include <cmath>
+
+namespace
+{
+
+bool isNumber(ExprAST* expr, double value)
+{
+    auto* number = llvm::dyn_cast<NumberExprAST>(expr);
+
+    // Confronta anche i bit: 0.0 e -0.0 non sono intercambiabili
+    return number && number->getVal() == value && std::signbit(number->getVal()) == std::signbit(value);
+}
+
+// Ogni visita semplifica prima i figli, poi restituisce il nodo che
+// sostituisce quello visitato (eventualmente il nodo stesso)
+class ConstantFolder : public ASTVisitor<ConstantFolder, ExprAST*>
+{
+  private:
+    driver& drv;
+    // Variabili visibili nel nodo visitato, dalla più esterna; ogni funzione
+    // parte da zero, come la symbol table di codegen
+    llvm::SmallVector<Param, 8> bound;
+
+    bool isBound(Symbol name, bool array) const
+    {
+        for (auto it = bound.rbegin(); it != bound.rend(); ++it)
+            if (it->name == name)
+                return it->array == array;
+        return false;
+    }
+
+    // Un'espressione il cui valore non è usato si può scartare solo se
+    // valutarla non può fallire: codegen deve comunque segnalare le variabili
+    // non dichiarate e gli array senza indice, e il controllo dei limiti deve
+    // restare per ogni accesso
+    bool isDiscardable(ExprAST* expr) const
+    {
+        if (!expr)
+            return true;
+
+        switch (expr->getKind())
+        {
+            case RootAST::AK_Number:
+                return true;
+            case RootAST::AK_Variable:
+                return isBound(llvm::cast<VariableExprAST>(expr)->getName(), false);
+            case RootAST::AK_Binary:
+            {
+                auto* binary = llvm::cast<BinaryExprAST>(expr);
+                return binary->getOp() != Operator::ASSIGN && isDiscardable(binary->getLHS()) && isDiscardable(binary->getRHS());
+            }
+            case RootAST::AK_Unary:
+                return isDiscardable(llvm::cast<UnaryExprAST>(expr)->getOperand());
+            case RootAST::AK_If:
+            {
+                auto* ifExpr = llvm::cast<IfExprNode>(expr);
+                return isDiscardable(ifExpr->getCondition()) && isDiscardable(ifExpr->getThen()) && isDiscardable(ifExpr->getElse());
+            }
+            case RootAST::AK_ArrayIndexing:
+            {
+                auto* access = llvm::cast<ArrayIndexingExprAST>(expr);
+                return !drv.boundsCheck && isBound(access->getName(), true) && isDiscardable(access->getIndex());
+            }
+            default:
+                return false;
+        }
+    }
+
+    ExprAST* replace(double value)
+    {
+        ++drv.foldedNodes;
+        return drv.make<NumberExprAST>(value);
+    }
+
+    ExprAST* replace(ExprAST* expr)
+    {
+        ++drv.foldedNodes;
+        return expr;
+    }
+
+  public:
+    ConstantFolder(driver& drv) :
+        drv(drv) {}
+
+    void foldChildren(RootAST* node)
+    {
+        forEachChild(node, [this](ExprAST*& child) { child = visit(child); });
+    }
+
+    ExprAST* visitRoot(RootAST* node)
+    {
+        foldChildren(node);
+        return llvm::dyn_cast<ExprAST>(node);
+    }
+
+    ExprAST* visitFunction(FunctionAST* node)
+    {
+        bound.assign(node->getProto()->getArgs().begin(), node->getProto()->getArgs().end());
+        foldChildren(node);
+        bound.clear();
+        return nullptr;
+    }
+
+    // La variabile del ciclo è visibile dopo il valore iniziale
+    ExprAST* visitFor(ForExprAST* node)
+    {
+        node->getStart() = visit(node->getStart());
+        bound.push_back({node->getVarName(), false});
+        node->getEnd() = visit(node->getEnd());
+        if (node->getStep())
+            node->getStep() = visit(node->getStep());
+        node->getBody() = visit(node->getBody());
+        bound.pop_back();
+        return node;
+    }
+
+    // Ogni variabile è visibile dopo il proprio inizializzatore
+    ExprAST* visitVar(VarExprAST* node)
+    {
+        size_t mark = bound.size();
+        for (auto& [name, init] : node->getVarNames())
+        {
+            if (init)
+                init = visit(init);
+            bound.push_back({name, init && llvm::isa<ArrayInitExprAST>(init)});
+        }
+        node->getBody() = visit(node->getBody());
+        bound.resize(mark);
+        return node;
+    }
+
+    ExprAST* visitBinary(BinaryExprAST* node)
+    {
+        foldChildren(node);
+
+        Operator op = node->getOp();
+        ExprAST* lhs = node->getLHS();
+        ExprAST* rhs = node->getRHS();
+
+        // Il lato sinistro di un assegnamento è una locazione, mai un valore
+        if (op == Operator::ASSIGN)
+            return node;
+
+        if (op == Operator::COLON)
+            return isDiscardable(lhs) ? replace(rhs) : node;
+
+        auto* l = llvm::dyn_cast<NumberExprAST>(lhs);
+        auto* r = llvm::dyn_cast<NumberExprAST>(rhs);
+
+        if (l && r)
+        {
+            switch (op)
+            {
+                case Operator::PLUS:
+                    return replace(l->getVal() + r->getVal());
+                case Operator::MINUS:
+                    return replace(l->getVal() - r->getVal());
+                case Operator::STAR:
+                    return replace(l->getVal() * r->getVal());
+                case Operator::SLASH:
+                    return replace(l->getVal() / r->getVal());
+                default:
+                    // I confronti seguono i predicati fcmp unordered usati da codegen
+                    return replace(compareUnordered(op, l->getVal(), r->getVal()) ? 1.0 : 0.0);
+            }
+        }
+
+        // Solo identità valide per ogni double, compresi NaN, infiniti e
+        // zeri con segno: x + 0.0 non è x quando x è -0.0
+        switch (op)
+        {
+            case Operator::PLUS:
+                if (isNumber(rhs, -0.0))
+                    return replace(lhs);
+                if (isNumber(lhs, -0.0))
+                    return replace(rhs);
+                break;
+            case Operator::MINUS:
+                if (isNumber(rhs, 0.0))
+                    return replace(lhs);
+                break;
+            case Operator::STAR:
+                if (isNumber(rhs, 1.0))
+                    return replace(lhs);
+                if (isNumber(lhs, 1.0))
+                    return replace(rhs);
+                break;
+            case Operator::SLASH:
+                if (isNumber(rhs, 1.0))
+                    return replace(lhs);
+                break;
+            default:
+                break;
+        }
+
+        return node;
+    }
+
+    ExprAST* visitUnary(UnaryExprAST* node)
+    {
+        foldChildren(node);
+
+        if (node->getOp() != Operator::MINUS)
+            return node;
+
+        if (auto* operand = llvm::dyn_cast<NumberExprAST>(node->getOperand()))
+            return replace(-operand->getVal());
+
+        // La negazione inverte solo il bit di segno, quindi si annulla esattamente
+        if (auto* inner = llvm::dyn_cast<UnaryExprAST>(node->getOperand()))
+            if (inner->getOp() == Operator::MINUS)
+                return replace(inner->getOperand());
+
+        return node;
+    }
+
+    ExprAST* visitIf(IfExprNode* node)
+    {
+        foldChildren(node);
+
+        auto* condition = llvm::dyn_cast<NumberExprAST>(node->getCondition());
+        if (!condition)
+            return node;
+
+        // Stesso test di codegen (fcmp one con 0.0): NaN sceglie il ramo else
+        bool taken = !std::isnan(condition->getVal()) && condition->getVal() != 0.0;
+        if (taken)
+            return replace(node->getThen());
+        if (node->getElse())
+            return replace(node->getElse());
+
+        // Senza ramo else non c'è un valore da sostituire
+        return node;
+    }
+};
+
+} // namespace
+
+RootAST* foldConstants(driver& drv, RootAST* node)
+{
+    ConstantFolder folder(drv);
+    auto* expr = llvm::dyn_cast<ExprAST>(node);
+
+    if (!expr)
+    {
+        folder.visit(node);
+        return node;
+    }
+
+    // Il sostituto prende il ruolo di espressione top-level
+    ExprAST* folded = folder.visit(expr);
+    if (folded != expr && expr->gettop())
+    {
+        expr->toggle();
+        folded->toggle();
+    }
+    return folded;
+}
@@ -0,0 +1,15 @@
+#ifndef CONSTANT_FOLDING_HH
+#define CONSTANT_FOLDING_HH
+
+class driver;
+class RootAST;
+
+// Semplifica l'AST di un elemento top-level prima della generazione del
+// codice: calcola le operazioni tra costanti (aritmetica, confronti, meno
+// unario), sceglie il ramo degli if con condizione costante, elimina gli
+// operandi sinistri di ':' privi di effetti collaterali e applica le
+// identità algebriche esatte in IEEE 754 (x*1, x/1, x-0, x+(-0), --x).
+// I nodi vengono sostituiti sul posto; restituisce la nuova radice.
+RootAST* foldConstants(driver& drv, RootAST* node);
+
+#endif
@@ -1,7 +1,12 @@
 #include "driver.hh"
+#include "constant_folding.hh"
+#include "function_cache.hh"
+#include "integer_inference.hh"
+#include "tail_calls.hh"
 #include "operator.hh"
 #include "parser.hh"
 #include <llvm/ADT/APFloat.h>
+#include <llvm/ADT/ScopeExit.h>
 #include <llvm/IR/BasicBlock.h>
 #include <llvm/IR/Constant.h>
 #include <llvm/IR/Constants.h>
@@ -13,34 +18,253 @@
 #include <llvm/IR/Operator.h>
 #include <llvm/IR/Type.h>
 #include <llvm/IR/Use.h>
+#include <llvm/Support/Format.h>
 #include <llvm/Support/raw_ostream.h>
+#include <iterator>
 #include <memory>
+#include <numeric>
 
 /*************************** Driver class *************************/
-driver::driver() :
-    trace_parsing(false), trace_scanning(false), ast_print(false)
+driver::driver(llvm::LLVMContext* sharedContext) :
+    trace_parsing(false), scanner(nullptr), trace_scanning(false), ast_print(false),
+    targetMachine(nullptr), optLevel(llvm::OptimizationLevel::O0), run_mode(false), print_stats(false)
 {
-    context = new llvm::LLVMContext;
-    module = new llvm::Module("Kaleidoscope", *context);
-    builder = new llvm::IRBuilder<>(*context);
+    if (!sharedContext)
+    {
+        ownedContext = std::make_unique<llvm::LLVMContext>();
+        sharedContext = ownedContext.get();
+    }
+    context = sharedContext;
+    module = std::make_unique<llvm::Module>("Kaleidoscope", *context);
+    builder = std::make_unique<llvm::IRBuilder<>>(*context);
 };
 
 int driver::parse(const std::string& f)
 {
     file = f;
     location.initialize(&file);
-    scan_begin();
+    if (!scan_begin())
+        return 1;
+    // La generazione del codice avviene nelle azioni del parser e segnala gli
+    // errori con eccezioni: il file va chiuso (e smappato) anche in quel caso
+    auto close = llvm::make_scope_exit([this]() { scan_end(); });
+    Phase phase(parseStats, "Parse", file);
     yy::parser parser(*this);
     parser.set_debug_level(trace_parsing);
-    int res = parser.parse();
-    scan_end();
-    return res;
+    return parser.parse();
 }
 
-void driver::codegen()
+// Nome della funzione definita o dichiarata da un elemento top-level
+static llvm::StringRef definitionName(const driver& drv, RootAST* top)
+{
+    if (auto* function = llvm::dyn_cast<FunctionAST>(top))
+        return drv.interner.name(function->getProto()->getName());
+    if (auto* prototype = llvm::dyn_cast<PrototypeAST>(top))
+        return drv.interner.name(prototype->getName());
+    return "";
+}
+
+void driver::codegen(RootAST* top)
 {
     if (ast_print)
-        root->visit();
-    std::cout << std::endl;
-    root->codegen(*this);
+    {
+        top->visit(*this);
+        std::cout << ";" << std::endl;
+    }
+    {
+        Phase phase(astPassesStats, "AST passes");
+        top = foldConstants(*this, top);
+        eliminateTailRecursion(*this, top);
+        markTailCalls(top);
+        inferIntegers(*this, top);
+    }
+    auto* definition = llvm::dyn_cast<FunctionAST>(top);
+    llvm::Function* function;
+    {
+        Phase phase(codegenStats, "Codegen", definitionName(*this, top));
+        if (definition && functionCache)
+            function = functionCache->codegen(*this, definition);
+        else
+            function = llvm::dyn_cast_or_null<llvm::Function>(top->codegen(*this));
+
+        if (print_stats && function && !function->isDeclaration())
+            functionInstructions.push_back({function->getName().str(), function->getInstructionCount()});
+    }
+
+    // Con la cache una nuova definizione viene ottimizzata e salvata subito,
+    // fuori dalla fase Codegen: la pipeline conta solo come Optimize, il
+    // resto come Cache store, ed entrambe sono tolte dal tempo di parsing
+    if (definition && functionCache && function)
+    {
+        PhaseStats before = optimizeStats;
+        {
+            Phase phase(cacheStats, "Cache store", definitionName(*this, top));
+            functionCache->optimize(*this, function);
+        }
+        PhaseStats pipeline = optimizeStats;
+        pipeline -= before;
+        cacheStats -= pipeline;
+        parseOptimizeStats += pipeline;
+    }
+
+    // L'AST di questo elemento non serve più: viene rilasciato in blocco,
+    // così la memoria dipende dalla definizione più grande e non dal file
+    releaseAST();
 };
+
+void driver::releaseAST()
+{
+    astPeakBytes = std::max(astPeakBytes, astArena.getBytesAllocated());
+    astArena.Reset();
+}
+
+void driver::reportArena()
+{
+    llvm::errs() << "AST arena: " << astPeakBytes << " bytes peak per top-level item, "
+                 << astArena.getTotalMemory() << " bytes reserved after release\n";
+}
+
+static const char* const astKindNames[] = {"prototype", "function", "number", "variable", "binary", "unary", "call",
+                                           "if", "for", "while", "var", "array declaration", "array indexing"};
+static_assert(std::size(astKindNames) == RootAST::AK_ExprLast + 1, "one name per AST node kind");
+
+static void reportPhase(llvm::StringRef name, const PhaseStats& stats)
+{
+    llvm::errs() << name << ": " << llvm::format("%.3f", stats.time.count()) << " ms, " << stats.allocations << " allocations, peak RSS +"
+                 << stats.peakRSSGrowth << " KiB\n";
+}
+
+void driver::reportStats()
+{
+    reportArena();
+    llvm::errs() << "AST nodes:";
+    for (size_t kind = 0; kind < astNodes.size(); ++kind)
+        if (astNodes[kind])
+            llvm::errs() << " " << astKindNames[kind] << " " << astNodes[kind] << ",";
+    llvm::errs() << " total " << std::accumulate(astNodes.begin(), astNodes.end(), size_t(0)) << "\n";
+    llvm::errs() << "Constant folding: " << foldedNodes << " nodes simplified\n";
+    llvm::errs() << "Integer inference: " << integerVariables << " variables kept in i64\n";
+    llvm::errs() << "Tail calls: " << tailRecursiveFunctions << " recursive functions turned into loops, " << tailCalls << " calls marked tail, "
+                 << mustTailCalls << " musttail\n";
+    if (boundsCheck)
+        llvm::errs() << "Bounds checks: " << boundsChecksEmitted << " emitted, " << boundsChecksEliminated << " eliminated ("
+                     << boundsChecksHoisted << " covered by loop preheader checks)\n";
+    if (functionCache)
+        llvm::errs() << "Function cache: " << functionCache->hits << " hits, " << functionCache->misses << " misses\n";
+
+    // Il parsing contiene le fasi successive di ogni elemento top-level
+    PhaseStats parseOnly = parseStats;
+    parseOnly -= astPassesStats;
+    parseOnly -= codegenStats;
+    parseOnly -= cacheStats;
+    parseOnly -= parseOptimizeStats;
+    reportPhase("Parse", parseOnly);
+    reportPhase("AST passes", astPassesStats);
+    reportPhase("Codegen", codegenStats);
+    if (functionCache)
+        reportPhase("Cache store", cacheStats);
+    reportPhase("Optimize", optimizeStats);
+    reportPhase("Emit", emitStats);
+
+    // Dopo l'ottimizzazione, se il modulo non è già passato al JIT
+    llvm::errs() << "IR instructions per function (codegen -> optimized):\n";
+    for (const auto& [name, count] : functionInstructions)
+    {
+        llvm::errs() << "  " << name << ": " << count;
+        if (llvm::Function* function = module->getFunction(name); function && !function->isDeclaration())
+            llvm::errs() << " -> " << function->getInstructionCount();
+        llvm::errs() << "\n";
+    }
+    llvm::errs() << "Peak RSS: " << peakRSSKilobytes() << " KiB\n";
+}
+
+std::unique_ptr<llvm::Module> driver::takeModule()
+{
+    std::unique_ptr<llvm::Module> current = std::move(module);
+
+    for (const llvm::Function& function : *current)
+    {
+        if (function.isIntrinsic() || !function.hasExternalLinkage())
+            continue;
+        KnownFunction& known = knownFunctions.try_emplace(function.getName(), KnownFunction{function.getFunctionType(), false}).first->second;
+        known.defined |= !function.isDeclaration();
+    }
+
+    module = std::make_unique<llvm::Module>("Kaleidoscope", *context);
+    module->setTargetTriple(current->getTargetTriple());
+    module->setDataLayout(current->getDataLayout());
+
+    return current;
+}
+
+llvm::Function* driver::getFunction(llvm::StringRef name)
+{
+    if (llvm::Function* function = module->getFunction(name))
+        return function;
+
+    auto known = knownFunctions.find(name);
+    if (known == knownFunctions.end())
+        return nullptr;
+    return llvm::Function::Create(known->second.type, llvm::Function::ExternalLinkage, name, *module);
+}
+
+void driver::optimize()
+{
+    // Con la cache delle funzioni ogni definizione è già stata ottimizzata
+    // da sola quando è stata generata, tranne quelle che la cache non gestisce
+    if (functionCache)
+        functionCache->optimizeRemaining(*this);
+    else
+        optimize(*module);
+}
+
+void driver::optimize(llvm::Module& target)
+{
+    Phase phase(optimizeStats, "Optimize");
+
+    // Gli analysis manager vanno dichiarati in quest'ordine perché siano
+    // distrutti nell'ordine giusto (vedi la documentazione del new pass manager)
+    llvm::LoopAnalysisManager LAM;
+    llvm::FunctionAnalysisManager FAM;
+    llvm::CGSCCAnalysisManager CGAM;
+    llvm::ModuleAnalysisManager MAM;
+
+    // La target machine permette alla pipeline di usare il modello dei costi
+    // della CPU effettiva (larghezza dei vettori, soglie di unrolling, ...)
+    llvm::PipelineTuningOptions PTO;
+    PTO.LoopVectorization = optLevel.getSpeedupLevel() > 1;
+    PTO.SLPVectorization = optLevel.getSpeedupLevel() > 1;
+    llvm::PassBuilder PB(targetMachine, PTO);
+
+    PB.registerModuleAnalyses(MAM);
+    PB.registerCGSCCAnalyses(CGAM);
+    PB.registerFunctionAnalyses(FAM);
+    PB.registerLoopAnalyses(LAM);
+    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+    llvm::ModulePassManager MPM;
+
+    if (optLevel == llvm::OptimizationLevel::O0)
+    {
+        MPM = PB.buildO0DefaultPipeline(optLevel, pipeline == Pipeline::LTOPreLink);
+    }
+    else if (pipeline == Pipeline::LTOPreLink)
+    {
+        // Stessa semplificazione, ma l'inlining sull'intero programma e
+        // unrolling/vettorizzazione dei cicli sono lasciati al collegamento
+        MPM = PB.buildLTOPreLinkDefaultPipeline(optLevel);
+    }
+    else if (pipeline == Pipeline::LTO)
+    {
+        // Prima le passate interprocedurali (IPSCCP, global DCE, inlining
+        // dei moduli uniti), poi di nuovo quelle sulle singole funzioni
+        MPM = PB.buildLTODefaultPipeline(optLevel, nullptr);
+    }
+    else
+    {
+        // mem2reg/SROA, instcombine, GVN, LICM, inlining, unrolling e vettorizzazione dei cicli
+        MPM = PB.buildPerModuleDefaultPipeline(optLevel);
+    }
+
+    MPM.run(target, MAM);
+}
@@ -3,6 +3,8 @@
 /************ Header file per la generazione del codice oggetto *************/
 #include "llvm/IR/LegacyPassManager.h"
 #include "llvm/MC/TargetRegistry.h"
+#include "llvm/Passes/OptimizationLevel.h"
+#include "llvm/Passes/PassBuilder.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Host.h"
 #include "llvm/Support/TargetSelect.h"
@@ -12,7 +14,10 @@
 /***************************************************************************/
 #include "parser.hh"
 #include "llvm/ADT/APFloat.h"
+#include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DerivedTypes.h"
@@ -22,7 +27,10 @@
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/Support/Allocator.h"
 #include <algorithm>
+#include <array>
+#include <chrono>
 #include <cctype>
 #include <cstdio>
 #include <cstdlib>
@@ -30,40 +38,167 @@
 #include <map>
 #include <memory>
 #include <string>
+#include <type_traits>
+#include <utility>
 #include <variant>
 #include <vector>
 
 #include "ast_node.hh"
+#include "compile_stats.hh"
+#include "symbol_table.hh"
+
+// Lo scanner è rientrante: il suo stato vive in un oggetto yyscan_t
+// posseduto dal driver, così che più driver possano lavorare in parallelo
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void* yyscan_t;
+#endif
 
 // Dichiarazione del prototipo yylex per Flex
 // Flex va proprio a cercare YY_DECL perché
 // deve espanderla (usando M4) nel punto appropriato
-#define YY_DECL yy::parser::symbol_type yylex(driver& drv)
+#define YY_DECL yy::parser::symbol_type yylex(driver& drv, yyscan_t yyscanner)
 // Per il parser è sufficiente una forward declaration
 YY_DECL;
 
+class FunctionCache;
+
+// Pipeline di ottimizzazione eseguita da driver::optimize
+enum class Pipeline
+{
+    PerModule, // Modulo che diventa direttamente codice oggetto
+    LTOPreLink, // Bitcode da collegare con altri moduli (--emit=bc)
+    LTO // Moduli già collegati, ottimizzati come un unico programma (--link)
+};
+
 // Classe che organizza e gestisce il processo di compilazione
 class driver
 {
   public:
-    driver();
+    driver(llvm::LLVMContext* sharedContext = nullptr);
+    std::unique_ptr<llvm::LLVMContext> ownedContext; // Vuoto se il contesto è condiviso (es. con il JIT)
     llvm::LLVMContext* context;
-    llvm::Module* module;
-    llvm::IRBuilder<>* builder;
-    std::map<std::string, llvm::AllocaInst*> symbolTable;
-    static inline int Cnt = 0; // Contatore incrementale, per identificare registri SSA
-    RootAST* root; // A fine parsing "punta" alla radice dell'AST
+    std::unique_ptr<llvm::Module> module;
+    std::unique_ptr<llvm::IRBuilder<>> builder;
+    StringInterner interner; // Nomi del programma: identificatori, funzioni, parametri
+    SymbolTable symbolTable; // Variabili visibili nel punto in cui si sta generando il codice
+    int Cnt = 0; // Contatore incrementale, per identificare registri SSA
     int parse(const std::string& f);
     std::string file;
     bool trace_parsing; // Abilita le tracce di debug el parser
-    void scan_begin(); // Implementata nello scanner
+    bool scan_begin(); // Implementata nello scanner
+    yyscan_t scanner; // Stato dello scanner rientrante
     void scan_end(); // Implementata nello scanner
+    char* sourceMap = nullptr; // Sorgente mappato in memoria, scandito sul posto (nullptr se letto da stream)
+    size_t sourceMapSize = 0; // Dimensione della mappatura, compresi i due byte sentinella di flex
     bool trace_scanning; // Abilita le tracce di debug nello scanner
     yy::location location; // Utillizata dallo scannar per localizzare i token
     bool ast_print;
-    void codegen();
+    bool print_ir = false; // Stampa su stderr l'IR di ogni funzione generata (-v)
+    void codegen(RootAST* top); // Genera il codice di un elemento top-level appena ridotto e ne rilascia l'AST
+    llvm::TargetMachine* targetMachine; // Macchina target, condivisa da pipeline di ottimizzazione ed emissione
+    llvm::OptimizationLevel optLevel; // Livello di ottimizzazione selezionato con -O0 ... -O3
+    void optimize(); // Esegue la pipeline di ottimizzazione sul modulo
+    Pipeline pipeline = Pipeline::PerModule; // Pipeline eseguita da optimize
+    void optimize(llvm::Module& target); // Esegue la pipeline su un modulo qualsiasi (es. una funzione della cache)
+    FunctionCache* functionCache = nullptr; // Cache delle funzioni compilate, se attiva (-fcache-dir)
+    bool run_mode; // Le espressioni top-level vengono conservate per essere eseguite (--run)
+    std::vector<std::string> topLevelExprs; // Funzioni anonime da eseguire, in ordine
+    std::unique_ptr<llvm::Module> takeModule(); // Cede il modulo corrente e ne crea uno nuovo
+    // Funzioni dei moduli già ceduti con takeModule (--run): il file
+    // successivo può chiamarle ma non ridefinirle
+    struct KnownFunction
+    {
+        llvm::FunctionType* type;
+        bool defined;
+    };
+    llvm::StringMap<KnownFunction> knownFunctions;
+    // La funzione name del modulo corrente; se è stata definita o dichiarata
+    // in un modulo precedente, ne inserisce qui la dichiarazione
+    llvm::Function* getFunction(llvm::StringRef name);
+    bool print_stats; // Stampa statistiche di compilazione (-stats)
+    PhaseStats parseStats; // Scanner e parser, comprese le fasi successive di ogni elemento top-level
+    PhaseStats astPassesStats; // Passate sull'AST prima della generazione del codice
+    PhaseStats codegenStats; // Generazione dell'IR
+    PhaseStats optimizeStats; // Pipeline di ottimizzazione
+    PhaseStats parseOptimizeStats; // Parte di optimizeStats spesa durante il parsing (con -fcache-dir)
+    PhaseStats cacheStats; // Estrazione, scrittura e ricollegamento delle funzioni nella cache, esclusa l'ottimizzazione
+    PhaseStats emitStats; // Scrittura del file di output (in kfe)
+    std::array<size_t, RootAST::AK_ExprLast + 1> astNodes{}; // Nodi dell'AST creati, per tipo (-stats)
+    std::vector<std::pair<std::string, unsigned>> functionInstructions; // Istruzioni IR di ogni funzione generata (-stats)
+    void reportStats(); // Stampa su stderr le statistiche raccolte (-stats)
+    size_t foldedNodes = 0; // Nodi dell'AST semplificati prima della generazione del codice (-stats)
+    bool integerInference = true; // Contatori e indici interi generati su i64 (-fno-integer-inference per disattivare)
+    size_t integerVariables = 0; // Variabili tenute in un i64 (-stats)
+    bool tailRecursionToLoop = true; // Ricorsione in coda riscritta come ciclo (-fno-tail-recursion-to-loop per disattivare)
+    size_t tailRecursiveFunctions = 0; // Funzioni riscritte come cicli (-stats)
+    size_t tailCalls = 0; // Chiamate marcate tail (-stats)
+    size_t mustTailCalls = 0; // Chiamate marcate musttail (-stats)
+    unsigned arrayAlign = 64; // Allineamento in byte della memoria degli array (-falign-arrays)
+    uint64_t stackArrayLimit = 64 * 1024; // Gli array più grandi (in byte) vanno sullo heap (-fstack-array-limit)
+    bool assumeNoalias = false; // I parametri array di una funzione non si sovrappongono (-fassume-noalias)
+    llvm::FastMathFlags fastMath; // Flag fast-math di tutte le funzioni (-ffast-math, -ffp-contract=fast, ...)
+
+    /************************* Controllo degli indici ************************/
+    bool boundsCheck = false; // Controlla gli indici degli array a runtime (-fbounds-check)
+    size_t boundsChecksEmitted = 0; // Controlli generati (uno per accesso o uno per ciclo)
+    size_t boundsChecksEliminated = 0; // Accessi senza controllo proprio, perché dimostrati o coperti da un ciclo
+    size_t boundsChecksHoisted = 0; // Di cui coperti dal controllo nel preheader di un ciclo
+    llvm::BasicBlock* boundsTrap = nullptr; // Blocco di errore della funzione corrente
+    // Accessi array[index] già verificati per il corpo del ciclo in generazione
+    struct CheckedIndex
+    {
+        Symbol index;
+        Symbol array;
+        // Con il controllo nel preheader, il solo accesso coperto (uno che il
+        // corpo esegue a ogni iterazione); null se l'indice è dimostrato nei
+        // limiti staticamente, e vale per ogni accesso array[index]
+        const ArrayIndexingExprAST* access;
+    };
+    std::vector<CheckedIndex> checkedIndices;
+    // Vero se la funzione in generazione passa uno dei suoi array locali a
+    // una chiamata: nessuna delle sue chiamate può allora essere in coda
+    bool localArrayEscapes = false;
+
+    /*********************** Arena dei nodi dell'AST ***********************/
+    // Tutti i nodi e le liste dell'AST vengono allocati in un bump-pointer
+    // allocator e rilasciati in blocco, senza chiamare distruttori. I nomi
+    // non stanno nell'arena ma nell'interner, che vive quanto il driver.
+    llvm::BumpPtrAllocator astArena;
+
+    template <typename T, typename... Args>
+    T* make(Args&&... args)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "AST nodes are released in bulk, without running destructors");
+        T* node = new (astArena.Allocate<T>()) T(std::forward<Args>(args)...);
+        if constexpr (std::is_base_of<RootAST, T>::value)
+            ++astNodes[node->getKind()];
+        return node;
+    }
+
+    // La lista costruita dal parser viene consumata: gli elementi passano
+    // nell'arena e il vettore temporaneo viene liberato. La lista è
+    // modificabile perché le passate sull'AST possono sostituirne gli elementi
+    template <typename T>
+    llvm::MutableArrayRef<T> save(std::vector<T>&& elements)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "AST lists are released in bulk, without running destructors");
+        T* copy = astArena.Allocate<T>(elements.size());
+        std::uninitialized_copy(elements.begin(), elements.end(), copy);
+        return llvm::MutableArrayRef<T>(copy, elements.size());
+    }
+
+    size_t astPeakBytes = 0; // Massima memoria occupata dall'AST di un singolo elemento top-level
+    void releaseAST(); // Rilascia in blocco tutti i nodi dell'AST
+    void reportArena(); // Memoria occupata dall'arena (-stats)
 };
 
+// Il parser chiama yylex(drv): lo scanner da usare è quello del driver
+inline yy::parser::symbol_type yylex(driver& drv)
+{
+    return yylex(drv, drv.scanner);
+}
+
 // void InitializeModule();
 
 #endif // ! DRIVER_HH
@@ -0,0 +1,384 @@
+#include "function_cache.hh"
+#include "ast_node.hh"
+#include "driver.hh"
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/SHA256.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ValueMapper.h>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+
+// Aggiunge alla chiave una serializzazione non ambigua di un sottoalbero:
+// ogni nodo inizia con il suo tipo e termina con un marcatore, i nomi sono
+// scritti per esteso (i simboli hanno senso solo in un driver) e i numeri
+// come sequenze di bit
+class ASTSerializer
+{
+  private:
+    const driver& drv;
+    std::string& out;
+
+    void token(llvm::StringRef text)
+    {
+        out += text;
+        out += '\0';
+    }
+
+    void token(uint64_t value) { token(llvm::utohexstr(value)); }
+
+    void name(Symbol symbol) { token(drv.interner.name(symbol)); }
+
+    void hints(const LoopHints& hints)
+    {
+        token(hints.unroll);
+        token(hints.vectorize);
+        token(hints.vectorWidth);
+    }
+
+  public:
+    ASTSerializer(const driver& drv, std::string& out) :
+        drv(drv), out(out) {}
+
+    void add(RootAST* node)
+    {
+        token(node->getKind());
+
+        switch (node->getKind())
+        {
+            case RootAST::AK_Function:
+            {
+                auto* function = llvm::cast<FunctionAST>(node);
+                name(function->getProto()->getName());
+                token(function->isFast());
+                for (const Param& param : function->getProto()->getArgs())
+                {
+                    name(param.name);
+                    token(param.array);
+                }
+                break;
+            }
+            case RootAST::AK_Number:
+            {
+                double value = llvm::cast<NumberExprAST>(node)->getVal();
+                uint64_t bits;
+                std::memcpy(&bits, &value, sizeof bits);
+                token(bits);
+                break;
+            }
+            case RootAST::AK_Variable:
+                name(llvm::cast<VariableExprAST>(node)->getName());
+                break;
+            case RootAST::AK_Binary:
+                token(uint64_t(llvm::cast<BinaryExprAST>(node)->getOp()));
+                break;
+            case RootAST::AK_Unary:
+                token(uint64_t(llvm::cast<UnaryExprAST>(node)->getOp()));
+                break;
+            case RootAST::AK_Call:
+                name(llvm::cast<CallExprAST>(node)->getCallee());
+                break;
+            case RootAST::AK_For:
+            {
+                auto* loop = llvm::cast<ForExprAST>(node);
+                name(loop->getVarName());
+                token(loop->getStep() != nullptr);
+                token(loop->hasIntegerInduction());
+                hints(loop->getHints());
+                break;
+            }
+            case RootAST::AK_If:
+                token(llvm::cast<IfExprNode>(node)->getElse() != nullptr);
+                break;
+            case RootAST::AK_While:
+                hints(llvm::cast<WhileExprAST>(node)->getHints());
+                break;
+            case RootAST::AK_Var:
+            {
+                auto* block = llvm::cast<VarExprAST>(node);
+                for (unsigned i = 0; i < block->getVarNames().size(); ++i)
+                {
+                    name(block->getVarNames()[i].first);
+                    token(block->isInteger(i));
+                }
+                break;
+            }
+            case RootAST::AK_ArrayInit:
+            {
+                auto* array = llvm::cast<ArrayInitExprAST>(node);
+                name(array->getName());
+                token(array->getCapacity());
+                break;
+            }
+            case RootAST::AK_ArrayIndexing:
+                name(llvm::cast<ArrayIndexingExprAST>(node)->getName());
+                break;
+            case RootAST::AK_Prototype:
+                break;
+        }
+
+        forEachChild(node, [this](ExprAST*& child) { add(child); });
+        token("end");
+    }
+};
+
+// Nomi di tutte le funzioni chiamate in un sottoalbero
+void collectCallees(RootAST* node, llvm::SmallDenseSet<Symbol, 8>& callees)
+{
+    if (auto* call = llvm::dyn_cast<CallExprAST>(node))
+        callees.insert(call->getCallee());
+    forEachChild(node, [&](ExprAST*& child) { collectCallees(child, callees); });
+}
+
+std::string hashToHex(llvm::StringRef data)
+{
+    llvm::SHA256 hash;
+    hash.update(data);
+    return llvm::toHex(hash.final(), /*LowerCase=*/true);
+}
+
+// Scrive in un file temporaneo e poi lo rinomina, così un lettore
+// concorrente o una build interrotta non vedono mai una voce parziale
+void writeAtomically(llvm::StringRef path, llvm::StringRef data)
+{
+    llvm::SmallString<128> temporary;
+    int fd;
+    if (llvm::sys::fs::createUniqueFile(path + ".%%%%%%.tmp", fd, temporary))
+        return;
+    {
+        llvm::raw_fd_ostream out(fd, /*shouldClose=*/true);
+        out << data;
+        if (out.has_error())
+        {
+            out.clear_error();
+            llvm::sys::fs::remove(temporary);
+            return;
+        }
+    }
+    if (llvm::sys::fs::rename(temporary, path))
+        llvm::sys::fs::remove(temporary);
+}
+
+// Un modulo con una copia di function e le dichiarazioni di ciò che chiama.
+// Restituisce null se la funzione usa globali che non sono funzioni.
+std::unique_ptr<llvm::Module> extractFunction(llvm::Function* function)
+{
+    llvm::Module* source = function->getParent();
+    auto single = std::make_unique<llvm::Module>(function->getName(), source->getContext());
+    single->setTargetTriple(source->getTargetTriple());
+    single->setDataLayout(source->getDataLayout());
+
+    llvm::ValueToValueMapTy map;
+    llvm::Function* copy = llvm::Function::Create(function->getFunctionType(), function->getLinkage(), function->getName(), *single);
+    map[function] = copy;
+
+    for (llvm::Instruction& instruction : llvm::instructions(function))
+    {
+        for (llvm::Value* operand : instruction.operands())
+        {
+            auto* global = llvm::dyn_cast<llvm::GlobalValue>(operand);
+            if (!global || map.count(global))
+                continue;
+
+            auto* callee = llvm::dyn_cast<llvm::Function>(global);
+            if (!callee)
+                return nullptr;
+
+            llvm::Function* declaration =
+                llvm::Function::Create(callee->getFunctionType(), llvm::Function::ExternalLinkage, callee->getName(), *single);
+            declaration->copyAttributesFrom(callee);
+            map[callee] = declaration;
+        }
+    }
+
+    auto argument = copy->arg_begin();
+    for (llvm::Argument& original : function->args())
+    {
+        argument->setName(original.getName());
+        map[&original] = &*argument++;
+    }
+
+    llvm::SmallVector<llvm::ReturnInst*, 4> returns;
+    llvm::CloneFunctionInto(copy, function, map, llvm::CloneFunctionChangeType::DifferentModule, returns);
+
+    // La clonazione in un altro modulo aggiunge sempre la lista delle
+    // compile unit di debug; vuota, farebbe solo emettere un avviso al lettore
+    if (llvm::NamedMDNode* units = single->getNamedMetadata("llvm.dbg.cu"); units && units->getNumOperands() == 0)
+        single->eraseNamedMetadata(units);
+    return single;
+}
+
+} // namespace
+
+FunctionCache::FunctionCache(std::string directory, std::string configuration) :
+    directory(std::move(directory)), configuration(std::move(configuration)) {}
+
+std::string FunctionCache::key(driver& drv, FunctionAST* function) const
+{
+    std::string data = configuration;
+    data += '\0';
+    ASTSerializer(drv, data).add(function);
+
+    // Ciò che la funzione vede di quelle che chiama: una definizione
+    // dell'utente nasconde un builtin, e l'ottimizzatore usa gli attributi
+    // delle dichiarazioni
+    llvm::SmallDenseSet<Symbol, 8> callees;
+    collectCallees(function, callees);
+    llvm::SmallVector<std::string, 8> signatures;
+    for (Symbol callee : callees)
+    {
+        std::string signature = drv.interner.name(callee).str() + ":";
+        if (llvm::Function* declaration = drv.module->getFunction(drv.interner.name(callee)))
+        {
+            llvm::raw_string_ostream out(signature);
+            declaration->getFunctionType()->print(out);
+            declaration->getAttributes().print(out);
+        }
+        signatures.push_back(std::move(signature));
+    }
+    llvm::sort(signatures);
+    for (const std::string& signature : signatures)
+    {
+        data += signature;
+        data += '\0';
+    }
+
+    return hashToHex(data);
+}
+
+llvm::Function* FunctionCache::codegen(driver& drv, FunctionAST* node)
+{
+    llvm::StringRef name = drv.interner.name(node->getProto()->getName());
+
+    // Una ridefinizione segue il percorso normale, che la segnala
+    if (llvm::Function* existing = drv.module->getFunction(name); existing && !existing->isDeclaration())
+        return llvm::dyn_cast_or_null<llvm::Function>(node->codegen(drv));
+
+    llvm::SmallString<128> path(directory);
+    llvm::sys::path::append(path, key(drv, node) + ".bc");
+
+    if (auto buffer = llvm::MemoryBuffer::getFile(path))
+    {
+        // Una voce corrotta viene semplicemente rigenerata
+        if (auto cached = llvm::parseBitcodeFile((*buffer)->getMemBufferRef(), *drv.context))
+        {
+            if (llvm::Linker::linkModules(*drv.module, std::move(*cached)))
+                throw std::runtime_error("Cannot link the cached code of " + name.str());
+            ++hits;
+            return drv.module->getFunction(name);
+        }
+        else
+        {
+            llvm::consumeError(cached.takeError());
+        }
+    }
+
+    auto* function = llvm::dyn_cast_or_null<llvm::Function>(node->codegen(drv));
+    if (!function)
+        return nullptr;
+    ++misses;
+    pending = std::string(path);
+    return function;
+}
+
+void FunctionCache::optimize(driver& drv, llvm::Function* function)
+{
+    if (pending.empty())
+        return;
+    std::string path = std::move(pending);
+    pending.clear();
+
+    std::string name = function->getName().str();
+    std::unique_ptr<llvm::Module> single = extractFunction(function);
+    if (!single)
+    {
+        unoptimized.push_back(name);
+        return;
+    }
+    drv.optimize(*single);
+
+    llvm::SmallVector<char, 0> bitcode;
+    llvm::raw_svector_ostream out(bitcode);
+    llvm::WriteBitcodeToFile(*single, out);
+    writeAtomically(path, llvm::StringRef(bitcode.data(), bitcode.size()));
+
+    // La copia ottimizzata sostituisce la funzione nel modulo
+    function->deleteBody();
+    if (llvm::Linker::linkModules(*drv.module, std::move(single)))
+        throw std::runtime_error("Cannot link the optimized code of " + name);
+}
+
+void FunctionCache::optimizeRemaining(driver& drv)
+{
+    if (unoptimized.empty())
+        return;
+
+    // La pipeline gira sull'intero modulo, con le funzioni già ottimizzate
+    // dalla cache marcate optnone perché le lasci come sono
+    llvm::StringSet<> remaining;
+    for (const std::string& name : unoptimized)
+        remaining.insert(name);
+
+    llvm::SmallVector<std::pair<llvm::Function*, bool>, 16> skipped;
+    for (llvm::Function& function : *drv.module)
+    {
+        if (function.isDeclaration() || remaining.count(function.getName()) ||
+            function.hasFnAttribute(llvm::Attribute::OptimizeNone))
+            continue;
+        skipped.push_back({&function, function.hasFnAttribute(llvm::Attribute::NoInline)});
+        function.addFnAttr(llvm::Attribute::OptimizeNone);
+        function.addFnAttr(llvm::Attribute::NoInline);
+    }
+
+    drv.optimize(*drv.module);
+
+    for (auto [function, noInline] : skipped)
+    {
+        function->removeFnAttr(llvm::Attribute::OptimizeNone);
+        if (!noInline)
+            function->removeFnAttr(llvm::Attribute::NoInline);
+    }
+    unoptimized.clear();
+}
+
+ObjectFileCache::ObjectFileCache(std::string directory, std::string configuration) :
+    directory(std::move(directory)), configuration(std::move(configuration)) {}
+
+std::string ObjectFileCache::path(const llvm::Module* module) const
+{
+    // L'IR senza il nome del modulo, che ORC ricava dalla partizione
+    std::string text;
+    llvm::raw_string_ostream out(text);
+    for (const llvm::Function& function : *module)
+        function.print(out);
+    for (const llvm::GlobalVariable& variable : module->globals())
+        variable.print(out);
+
+    llvm::SmallString<128> path(directory);
+    llvm::sys::path::append(path, hashToHex(configuration + '\0' + text) + ".o");
+    return std::string(path);
+}
+
+void ObjectFileCache::notifyObjectCompiled(const llvm::Module* module, llvm::MemoryBufferRef object)
+{
+    writeAtomically(path(module), object.getBuffer());
+}
+
+std::unique_ptr<llvm::MemoryBuffer> ObjectFileCache::getObject(const llvm::Module* module)
+{
+    auto buffer = llvm::MemoryBuffer::getFile(path(module));
+    if (!buffer)
+        return nullptr;
+    return std::move(*buffer);
+}
@@ -0,0 +1,73 @@
+#ifndef FUNCTION_CACHE_HH
+#define FUNCTION_CACHE_HH
+
+#include <llvm/ExecutionEngine/ObjectCache.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+class driver;
+class FunctionAST;
+
+// Cache su disco delle funzioni già compilate (-fcache-dir), indirizzata
+// per contenuto. La chiave di una definizione è l'hash del suo AST dopo
+// constant folding e inferenza degli interi, delle firme (tipo e
+// attributi) delle funzioni che chiama e della configurazione (target,
+// CPU, feature, opzioni di ottimizzazione e di generazione del codice).
+// Con la cache attiva ogni funzione viene ottimizzata da sola, senza
+// inlining fra definizioni diverse, e il suo bitcode ottimizzato viene
+// salvato: a un hit il bitcode viene collegato nel modulo senza rigenerare
+// né riottimizzare la funzione, e resta da fare solo l'emissione.
+class FunctionCache
+{
+  private:
+    std::string directory;
+    std::string configuration;
+    std::vector<std::string> unoptimized; // Funzioni che la cache non può gestire
+    std::string pending; // Voce da scrivere per la funzione appena generata
+
+    std::string key(driver& drv, FunctionAST* function) const;
+
+  public:
+    size_t hits = 0;
+    size_t misses = 0;
+
+    FunctionCache(std::string directory, std::string configuration);
+
+    // Genera la funzione nel modulo del driver, dalla cache se possibile;
+    // restituisce nullptr se la definizione non è valida
+    llvm::Function* codegen(driver& drv, FunctionAST* function);
+
+    // Se la funzione appena generata non veniva dalla cache, la ottimizza
+    // da sola e ne salva il bitcode; va chiamata dopo ogni codegen, fuori
+    // dalla fase Codegen
+    void optimize(driver& drv, llvm::Function* function);
+
+    // Ottimizza nel modulo del driver le funzioni rimaste fuori dalla
+    // cache (quelle che usano variabili globali), con la pipeline normale
+    void optimizeRemaining(driver& drv);
+};
+
+// ObjectCache per il JIT (--run): il codice macchina di ogni modulo
+// compilato da ORC (con la compilazione pigra, una funzione) viene salvato
+// con chiave l'hash del suo IR e della configurazione, e riusato a ogni
+// esecuzione successiva con lo stesso IR
+class ObjectFileCache : public llvm::ObjectCache
+{
+  private:
+    std::string directory;
+    std::string configuration;
+
+    std::string path(const llvm::Module* module) const;
+
+  public:
+    ObjectFileCache(std::string directory, std::string configuration);
+
+    void notifyObjectCompiled(const llvm::Module* module, llvm::MemoryBufferRef object) override;
+    std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module* module) override;
+};
+
+#endif
@@ -0,0 +1,293 @@
+#include "integer_inference.hh"
+#include "ast_node.hh"
+#include "driver.hh"
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/STLExtras.h>
+#include <llvm/Support/MathExtras.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+namespace
+{
+
+constexpr int64_t ExactLimit = int64_t(1) << 53;   // fin qui i double rappresentano ogni intero
+constexpr int64_t CounterLimit = int64_t(1) << 52; // grandezza supposta di una variabile intera
+constexpr int64_t InitLimit = int64_t(1) << 40;    // massimo valore assegnato se non da un passo
+constexpr int64_t MaxStep = 16;                    // massimo incremento di un contatore
+
+std::optional<int64_t> integralConstant(ExprAST* expr)
+{
+    auto* number = llvm::dyn_cast<NumberExprAST>(expr);
+    if (!number)
+        return std::nullopt;
+
+    // NaN non passa il primo test; -0.0 tornerebbe da i64 come +0.0
+    double value = number->getVal();
+    if (value != std::trunc(value) || std::fabs(value) > double(ExactLimit) || (value == 0 && std::signbit(value)))
+        return std::nullopt;
+    return int64_t(value);
+}
+
+bool within(const IntegerRange& range, int64_t limit)
+{
+    return range.low >= -limit && range.high <= limit;
+}
+
+// La dichiarazione di una variabile scalare: la variabile di induzione di
+// un ciclo for o un binding di un blocco var
+struct Declaration
+{
+    ExprAST* init; // null: la variabile parte da 0
+    ExprAST* step; // null: passo implicito 1 (o non è un ciclo)
+    ForExprAST* loop;
+    VarExprAST* block;
+    unsigned index; // posizione nel blocco var
+    bool integer = true; // ottimistico finché un assegnamento non lo smentisce
+    std::vector<ExprAST*> assigned; // lati destri degli assegnamenti
+};
+
+// Risolve ogni riferimento a variabile nella sua dichiarazione con le
+// stesse regole di visibilità di codegen, poi tiene come interi le
+// dichiarazioni i cui assegnamenti rispettano tutti le regole. Declassare
+// una variabile può declassare quelle calcolate da essa, quindi il
+// controllo si ripete finché nulla cambia.
+class IntegerInference : public ASTVisitor<IntegerInference>
+{
+  private:
+    std::vector<Declaration> declarations;
+    // Nomi visibili, il più interno per ultimo; -1 per i double (parametri, array)
+    std::vector<std::pair<Symbol, int>> scope;
+    llvm::DenseMap<VariableExprAST*, int> resolved;
+
+    int resolve(Symbol name) const
+    {
+        for (auto it = scope.rbegin(); it != scope.rend(); ++it)
+            if (it->first == name)
+                return it->second;
+        return -1;
+    }
+
+    void declare(Symbol name, Declaration declaration)
+    {
+        declarations.push_back(std::move(declaration));
+        scope.push_back({name, int(declarations.size() - 1)});
+    }
+
+    bool isInteger(VariableExprAST* variable) const
+    {
+        auto it = resolved.find(variable);
+        return it != resolved.end() && it->second >= 0 && declarations[it->second].integer;
+    }
+
+    bool isSmall(ExprAST* expr) const
+    {
+        auto range = integerRange(expr, [this](VariableExprAST* variable) { return isInteger(variable); });
+        return range && within(*range, InitLimit);
+    }
+
+    // v + c, c + v o v - c con |c| <= MaxStep, dove v è la dichiarazione
+    bool isStep(ExprAST* expr, int declaration) const
+    {
+        auto* binary = llvm::dyn_cast<BinaryExprAST>(expr);
+        if (!binary || (binary->getOp() != Operator::PLUS && binary->getOp() != Operator::MINUS))
+            return false;
+
+        auto isSelf = [&](ExprAST* operand) {
+            auto* variable = llvm::dyn_cast<VariableExprAST>(operand);
+            return variable && resolved.lookup(variable) == declaration;
+        };
+        auto isIncrement = [](ExprAST* operand) {
+            auto value = integralConstant(operand);
+            return value && std::abs(*value) <= MaxStep;
+        };
+
+        return (isSelf(binary->getLHS()) && isIncrement(binary->getRHS())) ||
+               (binary->getOp() == Operator::PLUS && isIncrement(binary->getLHS()) && isSelf(binary->getRHS()));
+    }
+
+    bool holdsIntegers(int id) const
+    {
+        const Declaration& declaration = declarations[id];
+
+        if (declaration.init && !isSmall(declaration.init))
+            return false;
+        if (declaration.loop && declaration.step)
+        {
+            auto step = integralConstant(declaration.step);
+            if (!step || std::abs(*step) > MaxStep)
+                return false;
+        }
+        return llvm::all_of(declaration.assigned, [&](ExprAST* value) { return isStep(value, id) || isSmall(value); });
+    }
+
+  public:
+    void visitRoot(RootAST* node)
+    {
+        forEachChild(node, [this](ExprAST*& child) { visit(child); });
+    }
+
+    void visitFunction(FunctionAST* node)
+    {
+        for (const Param& param : node->getProto()->getArgs())
+            scope.push_back({param.name, -1});
+        visitRoot(node);
+        scope.clear();
+    }
+
+    void visitVariable(VariableExprAST* node)
+    {
+        resolved[node] = resolve(node->getName());
+    }
+
+    void visitBinary(BinaryExprAST* node)
+    {
+        visitRoot(node);
+
+        if (node->getOp() != Operator::ASSIGN)
+            return;
+        if (auto* variable = llvm::dyn_cast<VariableExprAST>(node->getLHS()))
+            if (int id = resolved.lookup(variable); id >= 0)
+                declarations[id].assigned.push_back(node->getRHS());
+    }
+
+    // Il valore iniziale è valutato fuori dal ciclo, il resto dentro
+    void visitFor(ForExprAST* node)
+    {
+        visit(node->getStart());
+        declare(node->getVarName(), {node->getStart(), node->getStep(), node, nullptr, 0, true, {}});
+        visit(node->getEnd());
+        if (node->getStep())
+            visit(node->getStep());
+        visit(node->getBody());
+        scope.pop_back();
+    }
+
+    // Ogni inizializzatore vede i binding che lo precedono. Solo i primi 64
+    // binding di un blocco possono essere marcati (VarExprAST::setInteger).
+    void visitVar(VarExprAST* node)
+    {
+        size_t mark = scope.size();
+        auto bindings = node->getVarNames();
+
+        for (unsigned i = 0; i < bindings.size(); ++i)
+        {
+            ExprAST* init = bindings[i].second;
+
+            if (init)
+                visit(init);
+            if ((init && llvm::isa<ArrayInitExprAST>(init)) || i >= 64)
+            {
+                scope.push_back({bindings[i].first, -1});
+                continue;
+            }
+            declare(bindings[i].first, {init, nullptr, nullptr, node, i, true, {}});
+        }
+
+        visit(node->getBody());
+        scope.resize(mark);
+    }
+
+    // Marca le dichiarazioni intere sui loro nodi; restituisce quante sono
+    size_t solve()
+    {
+        for (bool changed = true; changed;)
+        {
+            changed = false;
+            for (int id = 0; id < int(declarations.size()); ++id)
+            {
+                if (declarations[id].integer && !holdsIntegers(id))
+                {
+                    declarations[id].integer = false;
+                    changed = true;
+                }
+            }
+        }
+
+        size_t count = 0;
+        for (Declaration& declaration : declarations)
+        {
+            if (!declaration.integer)
+                continue;
+            if (declaration.loop)
+                declaration.loop->setIntegerInduction();
+            else
+                declaration.block->setInteger(declaration.index);
+            ++count;
+        }
+        return count;
+    }
+};
+
+} // namespace
+
+std::optional<IntegerRange> integerRange(ExprAST* expr, llvm::function_ref<bool(VariableExprAST*)> isInteger)
+{
+    if (auto value = integralConstant(expr))
+        return IntegerRange{*value, *value};
+
+    if (auto* variable = llvm::dyn_cast<VariableExprAST>(expr))
+    {
+        if (isInteger(variable))
+            return IntegerRange{-CounterLimit, CounterLimit};
+        return std::nullopt;
+    }
+
+    std::optional<IntegerRange> result;
+
+    if (auto* unary = llvm::dyn_cast<UnaryExprAST>(expr))
+    {
+        // -0 in i64 è +0: l'operando non deve mai essere zero
+        auto operand = integerRange(unary->getOperand(), isInteger);
+        if (unary->getOp() == Operator::MINUS && operand && (operand->low > 0 || operand->high < 0))
+            result = IntegerRange{-operand->high, -operand->low};
+    }
+    else if (auto* binary = llvm::dyn_cast<BinaryExprAST>(expr))
+    {
+        Operator op = binary->getOp();
+        if (op != Operator::PLUS && op != Operator::MINUS && op != Operator::STAR)
+            return std::nullopt;
+
+        auto l = integerRange(binary->getLHS(), isInteger);
+        auto r = integerRange(binary->getRHS(), isInteger);
+        if (!l || !r)
+            return std::nullopt;
+
+        if (op == Operator::PLUS)
+        {
+            result = IntegerRange{l->low + r->low, l->high + r->high};
+        }
+        else if (op == Operator::MINUS)
+        {
+            result = IntegerRange{l->low - r->high, l->high - r->low};
+        }
+        else
+        {
+            // Un prodotto nullo è -0.0 se l'altro fattore è negativo, a
+            // meno che uno dei fattori sia sempre positivo
+            if (l->low < 1 && r->low < 1)
+                return std::nullopt;
+
+            int64_t products[4];
+            if (llvm::MulOverflow(l->low, r->low, products[0]) || llvm::MulOverflow(l->low, r->high, products[1]) ||
+                llvm::MulOverflow(l->high, r->low, products[2]) || llvm::MulOverflow(l->high, r->high, products[3]))
+                return std::nullopt;
+            result = IntegerRange{*std::min_element(products, products + 4), *std::max_element(products, products + 4)};
+        }
+    }
+
+    if (result && within(*result, ExactLimit))
+        return result;
+    return std::nullopt;
+}
+
+void inferIntegers(driver& drv, RootAST* node)
+{
+    if (!drv.integerInference)
+        return;
+
+    IntegerInference inference;
+    inference.visit(node);
+    drv.integerVariables += inference.solve();
+}
@@ -0,0 +1,36 @@
+#ifndef INTEGER_INFERENCE_HH
+#define INTEGER_INFERENCE_HH
+
+#include <llvm/ADT/STLFunctionalExtras.h>
+#include <cstdint>
+#include <optional>
+
+class driver;
+class RootAST;
+class ExprAST;
+class VariableExprAST;
+
+// Valori interi che un'espressione può assumere
+struct IntegerRange
+{
+    int64_t low;
+    int64_t high;
+};
+
+// Intervallo dei valori di un'espressione che, valutata in double, produce
+// sempre un intero rappresentato esattamente (|v| <= 2^53, mai -0.0): numeri
+// interi, variabili intere, +, -, * e meno unario. Ogni risultato intermedio
+// è esatto, quindi calcolarla su i64 dà lo stesso numero. isInteger dice
+// quali variabili sono intere; il loro valore è limitato a ±2^52.
+std::optional<IntegerRange> integerRange(ExprAST* expr, llvm::function_ref<bool(VariableExprAST*)> isInteger);
+
+// Individua le variabili scalari (contatori dei for e variabili dei blocchi
+// var) che contengono solo interi e le marca sui nodi che le dichiarano, così
+// che la generazione del codice le tenga in un i64. Una variabile è intera se
+// il valore iniziale e ogni valore assegnato sono interi piccoli (|v| <= 2^40)
+// oppure se viene solo incrementata o decrementata di una costante intera
+// (al più 16, come il passo di un for). Per superare ±2^52 servirebbero
+// almeno 2^48 incrementi: si assume che nessuna esecuzione ci arrivi.
+void inferIntegers(driver& drv, RootAST* node);
+
+#endif
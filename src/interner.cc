@@ -0,0 +1,24 @@
+#include "interner.hh"
+
+Symbol StringInterner::intern(llvm::StringRef name)
+{
+    auto [it, inserted] = ids.try_emplace(name, static_cast<Symbol>(names.size()));
+
+    if (inserted)
+    {
+        // La chiave conservata nella mappa non si sposta: può essere riferita direttamente
+        names.push_back(it->getKey());
+    }
+
+    return it->getValue();
+}
+
+llvm::StringRef StringInterner::name(Symbol id) const
+{
+    return names[id];
+}
+
+size_t StringInterner::size() const
+{
+    return names.size();
+}
@@ -0,0 +1,29 @@
+#ifndef INTERNER_HH
+#define INTERNER_HH
+
+#include <cstdint>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/Allocator.h>
+#include <vector>
+
+// Identificatore compatto di un nome del programma (variabile, funzione,
+// parametro): due occorrenze dello stesso nome hanno lo stesso Symbol
+using Symbol = uint32_t;
+
+// Tabella dei nomi, posseduta dal driver. Ogni nome distinto viene copiato
+// una sola volta; le occorrenze successive costano solo una ricerca nella
+// tabella hash, senza allocazioni.
+class StringInterner
+{
+  private:
+    llvm::StringMap<Symbol, llvm::BumpPtrAllocator> ids;
+    std::vector<llvm::StringRef> names; // names[id] punta alla chiave in ids
+
+  public:
+    Symbol intern(llvm::StringRef name);
+    llvm::StringRef name(Symbol id) const;
+    size_t size() const;
+};
+
+#endif
@@ -0,0 +1,104 @@
+#include "jit.hh"
+#include <cstdio>
+#include <llvm/ExecutionEngine/Orc/CompileOnDemandLayer.h>
+#include <llvm/ExecutionEngine/Orc/CompileUtils.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/Support/Error.h>
+#include <stdexcept>
+#include <utility>
+
+// Funzioni di libreria a disposizione dei programmi eseguiti con --run
+// (dichiarate con "extern printd(x);"). Il binario è linkato con -rdynamic
+// così che il JIT le trovi fra i simboli del processo.
+extern "C" double printd(double x)
+{
+    fprintf(stdout, "%f\n", x);
+    return 0;
+}
+
+extern "C" double putchard(double x)
+{
+    fputc(static_cast<char>(x), stdout);
+    return 0;
+}
+
+template <typename T>
+static T unwrap(llvm::Expected<T> value)
+{
+    if (!value)
+    {
+        throw std::runtime_error(llvm::toString(value.takeError()));
+    }
+
+    return std::move(*value);
+}
+
+static void check(llvm::Error error)
+{
+    if (error)
+    {
+        throw std::runtime_error(llvm::toString(std::move(error)));
+    }
+}
+
+JIT::JIT(const std::string& cpu, const std::string& features, llvm::ObjectCache* cache) :
+    context(std::make_unique<llvm::LLVMContext>()), targetMachineBuilder(unwrap(llvm::orc::JITTargetMachineBuilder::detectHost()))
+{
+    if (!cpu.empty() && cpu != "generic")
+    {
+        targetMachineBuilder.setCPU(cpu);
+    }
+
+    if (!features.empty())
+    {
+        targetMachineBuilder.addFeatures({features});
+    }
+
+    llvm::orc::LLLazyJITBuilder builder;
+    builder.setJITTargetMachineBuilder(targetMachineBuilder);
+
+    if (cache)
+    { // Lo stesso compilatore di default di LLJIT, con in più la cache degli oggetti
+        builder.setCompileFunctionCreator([cache](llvm::orc::JITTargetMachineBuilder jtmb)
+                                              -> llvm::Expected<std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler>> {
+            return std::make_unique<llvm::orc::ConcurrentIRCompiler>(std::move(jtmb), cache);
+        });
+    }
+
+    lljit = unwrap(builder.create());
+
+    // Compile-on-demand: ogni funzione viene compilata solo quando viene chiamata
+    lljit->setPartitionFunction(llvm::orc::CompileOnDemandLayer::compileRequested);
+
+    // I simboli extern vengono cercati fra quelli del processo host
+    lljit->getMainJITDylib().addGenerator(
+        unwrap(llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(lljit->getDataLayout().getGlobalPrefix())));
+}
+
+llvm::LLVMContext* JIT::getContext()
+{
+    return context.getContext();
+}
+
+const llvm::DataLayout& JIT::getDataLayout() const
+{
+    return lljit->getDataLayout();
+}
+
+std::unique_ptr<llvm::TargetMachine> JIT::createTargetMachine()
+{
+    return unwrap(targetMachineBuilder.createTargetMachine());
+}
+
+void JIT::addModule(std::unique_ptr<llvm::Module> module)
+{
+    check(lljit->addLazyIRModule(llvm::orc::ThreadSafeModule(std::move(module), context)));
+}
+
+double JIT::run(const std::string& name)
+{
+    auto address = unwrap(lljit->lookup(name));
+    auto* function = address.toPtr<double (*)()>();
+
+    return function();
+}
@@ -0,0 +1,43 @@
+#ifndef JIT_HH
+#define JIT_HH
+
+#include <llvm/ExecutionEngine/ObjectCache.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <memory>
+#include <string>
+
+// Esecuzione in-process dei moduli generati dal frontend (modalità --run).
+// Le funzioni vengono compilate pigramente, una alla volta, la prima volta
+// che vengono chiamate; i simboli extern sono risolti nel processo host.
+class JIT
+{
+  private:
+    llvm::orc::ThreadSafeContext context;
+    llvm::orc::JITTargetMachineBuilder targetMachineBuilder;
+    std::unique_ptr<llvm::orc::LLLazyJIT> lljit;
+
+  public:
+    // Se cache non è nullptr, il codice macchina viene cercato e salvato lì
+    JIT(const std::string& cpu, const std::string& features, llvm::ObjectCache* cache = nullptr);
+
+    // Contesto in cui devono essere creati i moduli passati ad addModule
+    llvm::LLVMContext* getContext();
+
+    const llvm::DataLayout& getDataLayout() const;
+
+    // Una macchina con la stessa CPU e le stesse feature di quella che genera
+    // il codice del JIT, per ottimizzare i moduli prima di aggiungerli
+    std::unique_ptr<llvm::TargetMachine> createTargetMachine();
+
+    void addModule(std::unique_ptr<llvm::Module>);
+
+    // Chiama una funzione senza argomenti (es. un'espressione top-level)
+    double run(const std::string& name);
+};
+
+#endif
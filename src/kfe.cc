@@ -1,18 +1,838 @@
 #include "driver.hh"
+#include "function_cache.hh"
+#include "jit.hh"
+#include "multiversion.hh"
+#include <chrono>
+#include <cstdint>
+#include <llvm/ADT/ScopeExit.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/ADT/StringSet.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/IRReader/IRReader.h>
+#include <llvm/Linker/Linker.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/MathExtras.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/Threading.h>
 #include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/TimeProfiler.h>
 #include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/xxhash.h>
 #include <llvm/Target/TargetOptions.h>
+#include <llvm/Transforms/IPO/Internalize.h>
+#include <memory>
 #include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
 
 using namespace llvm;
 
-int main(int argc, char* argv[])
+// Formato del file prodotto (--emit)
+enum class EmitKind
+{
+    Object, // obj: codice oggetto (default)
+    Assembly, // asm: assembly del target
+    IR, // llvm: IR testuale
+    Bitcode // bc: bitcode
+};
+
+// Opzioni della riga di comando, condivise da tutti i file in input
+struct Options
+{
+    bool trace_parsing = false;
+    bool trace_scanning = false;
+    bool ast_print = false;
+    bool print_ir = false;
+    bool run_mode = false;
+    bool multiversion = false;
+    bool print_stats = false;
+    bool timeTrace = false;
+    std::string timeTraceFile = ""; // Vuoto: <output>.time-trace o kfe.time-trace
+    unsigned timeTraceGranularity = 500; // Durata minima (µs) di uno span registrato
+    llvm::OptimizationLevel optLevel = llvm::OptimizationLevel::O0;
+    llvm::CodeGenOpt::Level codegenOptLevel = llvm::CodeGenOpt::None;
+    std::string CPU = "generic";
+    std::string Features = "";
+    std::string Output = ""; // Il default è che il codice oggetto non viene generato; "-" è lo standard output
+    EmitKind emit = EmitKind::Object;
+    unsigned jobs = 0; // 0 = compilazione sequenziale, senza report
+    unsigned arrayAlign = 64;
+    uint64_t stackArrayLimit = 64 * 1024;
+    bool boundsCheck = false;
+    bool assumeNoalias = false;
+    llvm::FastMathFlags fastMath;
+    bool integerInference = true;
+    bool tailRecursionToLoop = true;
+    std::string cacheDir = ""; // Vuoto: nessuna cache delle funzioni compilate
+    bool link = false; // --link: un solo file di output per tutti i file in input
+    std::vector<std::string> exports; // Simboli visibili dopo --link; vuoto: tutte le definizioni
+};
+
+// Esito della compilazione di un singolo file, per il report finale
+struct CompileResult
 {
     int exitCode = 0;
+    double milliseconds = 0;
+};
+
+// Restituisce le feature della CPU host nel formato di -mattr (+avx2,-avx512f,...)
+static std::string hostCPUFeatures()
+{
+    llvm::StringMap<bool> hostFeatures;
+    std::string features;
+
+    if (!llvm::sys::getHostCPUFeatures(hostFeatures))
+    {
+        return features;
+    }
+
+    for (const auto& feature : hostFeatures)
+    {
+        if (!features.empty())
+        {
+            features += ",";
+        }
+
+        features += (feature.getValue() ? "+" : "-") + feature.getKey().str();
+    }
+
+    return features;
+}
+
+static void configureDriver(driver& drv, const Options& options)
+{
+    drv.trace_parsing = options.trace_parsing;
+    drv.trace_scanning = options.trace_scanning;
+    drv.ast_print = options.ast_print;
+    drv.print_ir = options.print_ir;
+    // Se l'IR non viene mai stampato, i nomi dei valori sono solo un costo
+    drv.context->setDiscardValueNames(!options.print_ir && options.emit != EmitKind::IR);
+    drv.run_mode = options.run_mode;
+    drv.optLevel = options.optLevel;
+    drv.print_stats = options.print_stats;
+    drv.arrayAlign = options.arrayAlign;
+    drv.stackArrayLimit = options.stackArrayLimit;
+    drv.boundsCheck = options.boundsCheck;
+    drv.assumeNoalias = options.assumeNoalias;
+    drv.fastMath = options.fastMath;
+    drv.integerInference = options.integerInference;
+    drv.tailRecursionToLoop = options.tailRecursionToLoop;
+    // Il bitcode viene poi collegato e ottimizzato di nuovo con --link
+    drv.pipeline = options.emit == EmitKind::Bitcode ? Pipeline::LTOPreLink : Pipeline::PerModule;
+}
+
+// Identifica il compilatore con l'hash (xxHash64) del contenuto del suo
+// eseguibile: una nuova versione di kfe, o una build con altre opzioni, non
+// riusa le voci della cache prodotte da un'altra. Il file viene letto una
+// sola volta per processo, anche con -j; stringa vuota se non è leggibile.
+static std::string compilerIdentity()
+{
+    static const std::string identity = []() {
+        std::string path = llvm::sys::fs::getMainExecutable(nullptr, (void*)(intptr_t)&compilerIdentity);
+        auto buffer = llvm::MemoryBuffer::getFile(path, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+        if (!buffer)
+            return std::string();
+        return llvm::utohexstr(llvm::xxHash64((*buffer)->getBuffer()));
+    }();
+    return identity;
+}
+
+// Tutto ciò che, oltre al sorgente, determina il codice prodotto: fa parte
+// della chiave di ogni elemento della cache (-fcache-dir)
+static std::string cacheConfiguration(const Options& options, const std::string& TargetTriple)
+{
+    std::string configuration;
+    llvm::raw_string_ostream out(configuration);
+    out << "kfe " << compilerIdentity() << " LLVM " << LLVM_VERSION_STRING << "\n"
+        << TargetTriple << " " << options.CPU << " " << options.Features << "\n"
+        << "O" << options.optLevel.getSpeedupLevel() << " Os" << options.optLevel.getSizeLevel() << " CG" << int(options.codegenOptLevel)
+        << " fast-math ";
+    options.fastMath.print(out);
+    out << " bounds-check " << options.boundsCheck << " noalias " << options.assumeNoalias << " integers " << options.integerInference
+        << " align " << options.arrayAlign << " stack-limit " << options.stackArrayLimit
+        << (options.emit == EmitKind::Bitcode ? " lto-prelink" : "") << "\n";
+    return configuration;
+}
+
+// Crea la directory della cache; in caso di errore la cache resta disattivata
+static bool prepareCacheDir(const Options& options)
+{
+    if (compilerIdentity().empty())
+    {
+        errs() << "Cannot read the compiler executable: the cache is disabled\n";
+        return false;
+    }
+    if (std::error_code EC = llvm::sys::fs::create_directories(options.cacheDir))
+    {
+        errs() << "Cannot create the cache directory " << options.cacheDir << ": " << EC.message() << "\n";
+        return false;
+    }
+    return true;
+}
+
+static llvm::TargetMachine* createTargetMachine(const llvm::Target* Target, const std::string& TargetTriple, const Options& options)
+{
+    llvm::TimeTraceScope trace("Target machine");
+    TargetOptions opt;
+    auto RM = std::optional<llvm::Reloc::Model>();
+
+    return Target->createTargetMachine(TargetTriple, options.CPU, options.Features, opt, RM, std::nullopt, options.codegenOptLevel);
+}
+
+// Scrive il modulo in dest nel formato scelto con --emit
+static bool emitModule(const Options& options, llvm::TargetMachine& targetMachine, llvm::Module& module, llvm::raw_pwrite_stream& dest)
+{
+    if (options.emit == EmitKind::IR)
+    {
+        module.print(dest, nullptr);
+        return true;
+    }
+
+    if (options.emit == EmitKind::Bitcode)
+    {
+        llvm::WriteBitcodeToFile(module, dest);
+        return true;
+    }
+
+    legacy::PassManager pass;
+    auto FileType = options.emit == EmitKind::Assembly ? CGFT_AssemblyFile : CGFT_ObjectFile;
+    if (targetMachine.addPassesToEmitFile(pass, dest, nullptr, FileType))
+    {
+        errs() << "TheTargetMachine can't emit a file of this type";
+        return false;
+    }
+    pass.run(module); // Compilazione dell'IR prodotto dal frontend
+    return true;
+}
+
+// Analizza inputFile e ne genera l'IR; false in caso di errore. Gli errori
+// della generazione del codice, che avviene nelle azioni del parser, escono
+// da drv.parse come eccezioni e vengono riportati come quelli di sintassi
+static bool parseFile(driver& drv, const std::string& inputFile)
+{
+    try
+    {
+        return drv.parse(inputFile) == 0;
+    }
+    catch (const std::exception& e)
+    {
+        errs() << inputFile << ":" << drv.location.begin.line << ": " << e.what() << "\n";
+        return false;
+    }
+}
+
+// Compila un file in input nel file oggetto Filename. Ogni chiamata usa un
+// proprio driver (quindi un proprio LLVMContext) e una propria macchina
+// target, così che più file possano essere compilati in parallelo.
+static int compileFile(const Options& options, const llvm::Target* Target, const std::string& TargetTriple,
+                       const std::string& inputFile, const std::string& Filename, bool verbose)
+{
+    // Dichiarata prima del driver, che la usa fino alla propria distruzione
+    std::optional<FunctionCache> cache;
     driver drv;
+    configureDriver(drv, options);
+
+    // Le versioni AVX2 di -fmultiversion vengono ottimizzate con il modulo:
+    // con la cache ogni funzione è già ottimizzata quando viene generata
+    if (options.cacheDir != "" && options.multiversion)
+    {
+        errs() << "-fcache-dir is ignored with -fmultiversion\n";
+    }
+    else if (options.cacheDir != "")
+    {
+        cache.emplace(options.cacheDir, cacheConfiguration(options, TargetTriple));
+        drv.functionCache = &*cache;
+    }
+    auto stats = llvm::make_scope_exit([&drv]() {
+        if (drv.print_stats)
+        {
+            drv.reportStats();
+        }
+    });
+
+    std::unique_ptr<llvm::TargetMachine> TheTargetMachine(createTargetMachine(Target, TargetTriple, options));
+    /************************* Configurazione del modulo *****************/
+    drv.module->setDataLayout(TheTargetMachine->createDataLayout());
+    drv.module->setTargetTriple(TargetTriple);
+    drv.targetMachine = TheTargetMachine.get(); // La stessa macchina guida ottimizzazione ed emissione
+
+    if (!parseFile(drv, inputFile))
+    { // Parsing e generazione dell'IR, una definizione alla volta
+        return 1;
+    }
+
+    if (options.multiversion && !emitMultiversions(*drv.module, *TheTargetMachine))
+    {
+        errs() << "-fmultiversion is only supported on x86 targets\n";
+    }
+    drv.optimize(); // Pipeline di ottimizzazione selezionata con -O
+
+    if (Filename == "")
+    {
+        return 0;
+    }
+
+    /*****************************************************************/
+    /******************** Generazione del file di output *************/
+    /*****************************************************************/
+    // raw_fd_ostream è bufferizzato e con "-" scrive sullo standard output
+    bool text = options.emit == EmitKind::Assembly || options.emit == EmitKind::IR;
+    std::error_code EC;
+    raw_fd_ostream dest(Filename, EC, text ? sys::fs::OF_Text : sys::fs::OF_None);
+    if (EC)
+    {
+        errs() << "Could not open file: " << EC.message();
+        return 1;
+    }
+    {
+        Phase phase(drv.emitStats, "Emit", Filename);
+
+        if (!emitModule(options, *TheTargetMachine, *drv.module, dest))
+        {
+            return 1;
+        }
+        dest.flush();
+    }
+    if (verbose && Filename != "-")
+    {
+        outs() << "Wrote " << Filename << "\n";
+    }
+    return 0;
+}
+
+// Modalità --run: un solo driver e un solo JIT per tutti i file, così che
+// un file possa chiamare le funzioni definite nei file precedenti
+static int runFiles(const Options& options, const std::string& TargetTriple, const std::vector<std::string>& inputFiles)
+{
+    int exitCode = 0;
+    std::unique_ptr<JIT> jit;
+    std::unique_ptr<llvm::TargetMachine> TheTargetMachine;
+    // Il codice macchina di ogni funzione compilata dal JIT viene riusato
+    // nelle esecuzioni successive
+    std::unique_ptr<ObjectFileCache> cache;
+    if (options.cacheDir != "" && prepareCacheDir(options))
+    {
+        // Salvo -mcpu, il JIT genera codice per la CPU host, che fa quindi
+        // parte della chiave
+        Options keyOptions = options;
+        if (keyOptions.CPU.empty() || keyOptions.CPU == "generic")
+        {
+            keyOptions.CPU = llvm::sys::getHostCPUName().str();
+            keyOptions.Features = hostCPUFeatures() + (options.Features.empty() ? "" : "," + options.Features);
+        }
+        cache = std::make_unique<ObjectFileCache>(options.cacheDir, cacheConfiguration(keyOptions, TargetTriple));
+    }
+
+    try
+    {
+        jit = std::make_unique<JIT>(options.CPU, options.Features, cache.get());
+        // L'ottimizzatore usa la stessa CPU del JIT (quella host, salvo -mcpu)
+        TheTargetMachine = jit->createTargetMachine();
+    }
+    catch (const std::runtime_error& e)
+    {
+        errs() << "Cannot create the JIT: " << e.what() << "\n";
+        return 1;
+    }
+
+    // Il driver lavora nel contesto del JIT, condiviso da tutti i moduli compilati
+    driver drv(jit->getContext());
+    configureDriver(drv, options);
+
+    drv.module->setTargetTriple(TheTargetMachine->getTargetTriple().str());
+    drv.targetMachine = TheTargetMachine.get();
+    drv.module->setDataLayout(jit->getDataLayout());
+
+    for (const auto& inputFile : inputFiles)
+    {
+        if (!parseFile(drv, inputFile))
+        {
+            exitCode = 1;
+            continue;
+        }
+
+        drv.optimize();
+
+        /*****************************************************************/
+        /************ Esecuzione delle espressioni top-level *************/
+        /*****************************************************************/
+        try
+        {
+            // Le definizioni restano disponibili anche per i file successivi
+            jit->addModule(drv.takeModule());
+
+            for (const auto& name : drv.topLevelExprs)
+            {
+                outs() << jit->run(name) << "\n";
+            }
+        }
+        catch (const std::runtime_error& e)
+        {
+            errs() << e.what() << "\n";
+            exitCode = 1;
+        }
+
+        drv.topLevelExprs.clear();
+
+        if (drv.print_stats)
+        {
+            drv.reportStats();
+        }
+    }
+
+    return exitCode;
+}
+
+// Scrive la traccia di -ftime-trace (tutti i thread) e restituisce exitCode
+static int finishTimeTrace(const Options& options, const std::string& fallbackName, int exitCode)
+{
+    if (!options.timeTrace)
+    {
+        return exitCode;
+    }
+
+    if (llvm::Error error = llvm::timeTraceProfilerWrite(options.timeTraceFile, fallbackName))
+    {
+        errs() << "Could not write the time trace: " << llvm::toString(std::move(error)) << "\n";
+        exitCode = 1;
+    }
+    llvm::timeTraceProfilerCleanup();
+
+    return exitCode;
+}
+
+// Estensione del file prodotto nel formato scelto con --emit
+static const char* outputExtension(EmitKind emit)
+{
+    switch (emit)
+    {
+        case EmitKind::Assembly:
+            return ".s";
+        case EmitKind::IR:
+            return ".ll";
+        case EmitKind::Bitcode:
+            return ".bc";
+        default:
+            return ".o";
+    }
+}
+
+// Nome del file di output per inputFile: con più file (o con -j) l'argomento
+// di -o è la directory di destinazione, altrimenti il nome senza estensione
+// ("-" resta lo standard output)
+static std::string objectFileName(const Options& options, const std::string& inputFile, bool batch)
+{
+    if (options.Output == "" || options.Output == "-")
+    {
+        return options.Output;
+    }
+
+    if (!batch)
+    {
+        return options.Output + outputExtension(options.emit);
+    }
+
+    llvm::SmallString<128> path(options.Output);
+    llvm::sys::path::append(path, llvm::sys::path::stem(inputFile) + outputExtension(options.emit));
+
+    return std::string(path);
+}
+
+// Carica un modulo da collegare con --link: bitcode o IR testuale (.bc, .ll)
+// così come sono, oppure un sorgente .k compilato nel contesto del link
+static std::unique_ptr<llvm::Module> loadModule(const Options& options, llvm::LLVMContext& context, llvm::TargetMachine& targetMachine,
+                                                const std::string& TargetTriple, const std::string& inputFile)
+{
+    llvm::StringRef extension = llvm::sys::path::extension(inputFile);
+    if (extension == ".bc" || extension == ".ll")
+    {
+        llvm::TimeTraceScope trace("Load", inputFile);
+        llvm::SMDiagnostic error;
+        std::unique_ptr<llvm::Module> module = llvm::parseIRFile(inputFile, error, context);
+        if (!module)
+        {
+            error.print("kfe", errs());
+        }
+        return module;
+    }
+
+    driver drv(&context);
+    configureDriver(drv, options);
+    drv.pipeline = Pipeline::LTOPreLink;
+    drv.module->setDataLayout(targetMachine.createDataLayout());
+    drv.module->setTargetTriple(TargetTriple);
+    drv.targetMachine = &targetMachine;
+
+    if (!parseFile(drv, inputFile))
+    {
+        return nullptr;
+    }
+    drv.optimize();
+
+    if (drv.print_stats)
+    {
+        drv.reportStats();
+    }
+    return drv.takeModule();
+}
+
+// Modalità --link: i moduli di tutti i file in input vengono uniti in uno
+// solo, le definizioni non esportate (--export) diventano interne e la
+// pipeline LTO ottimizza il programma intero, così che le funzioni di un
+// file possano essere espanse inline in quelle di un altro
+static int linkFiles(const Options& options, const llvm::Target* Target, const std::string& TargetTriple,
+                     const std::vector<std::string>& inputFiles)
+{
+    if (options.Output == "")
+    {
+        errs() << "--link requires -o\n";
+        return 1;
+    }
+
+    llvm::LLVMContext context;
+    // Il driver del link riceve i moduli collegati e li ottimizza
+    driver drv(&context);
+    configureDriver(drv, options);
+    drv.pipeline = Pipeline::LTO;
+    auto stats = llvm::make_scope_exit([&drv]() {
+        if (drv.print_stats)
+        {
+            drv.reportStats();
+        }
+    });
+
+    std::unique_ptr<llvm::TargetMachine> TheTargetMachine(createTargetMachine(Target, TargetTriple, options));
+    drv.module->setDataLayout(TheTargetMachine->createDataLayout());
+    drv.module->setTargetTriple(TargetTriple);
+    drv.targetMachine = TheTargetMachine.get();
+
+    {
+        llvm::TimeTraceScope trace("Link");
+        llvm::Linker linker(*drv.module);
+
+        for (const auto& inputFile : inputFiles)
+        {
+            std::unique_ptr<llvm::Module> module = loadModule(options, context, *TheTargetMachine, TargetTriple, inputFile);
+            // Gli errori del linker (es. simboli definiti due volte) sono già stati stampati
+            if (!module || linker.linkInModule(std::move(module)))
+            {
+                errs() << "Cannot link " << inputFile << "\n";
+                return 1;
+            }
+        }
+    }
+
+    if (!options.exports.empty())
+    {
+        llvm::StringSet<> exported;
+        for (const auto& name : options.exports)
+        {
+            exported.insert(name);
+
+            if (!drv.module->getNamedValue(name))
+            {
+                errs() << "warning: exported symbol " << name << " is not defined\n";
+            }
+        }
+
+        llvm::internalizeModule(*drv.module, [&exported](const llvm::GlobalValue& value) { return exported.contains(value.getName()); });
+    }
+
+    if (options.multiversion && !emitMultiversions(*drv.module, *TheTargetMachine))
+    {
+        errs() << "-fmultiversion is only supported on x86 targets\n";
+    }
+    drv.optimize();
+
+    std::string Filename = objectFileName(options, "", false);
+    bool text = options.emit == EmitKind::Assembly || options.emit == EmitKind::IR;
+    std::error_code EC;
+    raw_fd_ostream dest(Filename, EC, text ? sys::fs::OF_Text : sys::fs::OF_None);
+    if (EC)
+    {
+        errs() << "Could not open file: " << EC.message();
+        return 1;
+    }
+    {
+        Phase phase(drv.emitStats, "Emit", Filename);
+
+        if (!emitModule(options, *TheTargetMachine, *drv.module, dest))
+        {
+            return 1;
+        }
+        dest.flush();
+    }
+    if (Filename != "-")
+    {
+        outs() << "Wrote " << Filename << "\n";
+    }
+    return 0;
+}
+
+// Segnala un errore nella riga di comando, seguito dall'uso di kfe
+static int usageError(const std::string& message)
+{
+    errs() << message << "\nUsage: kfe [options] <file.k>...\n";
+    return 1;
+}
+
+// Valore di un'opzione numerica: un intero senza segno fra 0 e max, scritto
+// per intero (senza segno né altri caratteri dopo le cifre)
+static std::optional<uint64_t> parseUnsigned(const std::string& text, uint64_t max)
+{
+    if (text.empty() || !llvm::isDigit(text[0]))
+    {
+        return std::nullopt;
+    }
+    try
+    {
+        size_t end;
+        uint64_t value = std::stoull(text, &end);
+        if (end != text.size() || value > max)
+        {
+            return std::nullopt;
+        }
+        return value;
+    }
+    catch (const std::invalid_argument&)
+    {
+        return std::nullopt;
+    }
+    catch (const std::out_of_range&)
+    {
+        return std::nullopt;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    int exitCode = 0;
+    Options options;
+    int i = 1;
+    std::vector<std::string> inputFiles;
+
+    // Le opzioni vengono lette tutte prima di configurare il target, così
+    // che valgano per ogni file in input indipendentemente dalla posizione
+    while (i < argc)
+    {
+        if (argv[i] == std::string("-p"))
+        {
+            options.trace_parsing = true; // Abilita tracce debug nel parser
+        }
+        else if (argv[i] == std::string("-s"))
+        {
+            options.trace_scanning = true; // Abilita tracce debug nello scanner
+        }
+        else if (argv[i] == std::string("-v"))
+        {
+            options.ast_print = true; // Stampa una rapp. esterna dell'AST
+            options.print_ir = true; // e l'IR di ogni funzione
+        }
+        else if (argv[i] == std::string("-stats"))
+        {
+            options.print_stats = true; // Statistiche di compilazione su stderr
+        }
+        else if (argv[i] == std::string("-ftime-trace") || std::string(argv[i]).rfind("-ftime-trace=", 0) == 0)
+        {
+            options.timeTrace = true; // Traccia Chrome (trace event JSON) delle fasi della compilazione
+            std::string argument = argv[i];
+            options.timeTraceFile = argument.size() > 13 ? argument.substr(13) : ""; // -ftime-trace=<file>
+        }
+        else if (std::string(argv[i]).rfind("-ftime-trace-granularity=", 0) == 0)
+        {
+            auto granularity = parseUnsigned(std::string(argv[i]).substr(25), UINT32_MAX); // In microsecondi
+            if (!granularity)
+            {
+                return usageError("-ftime-trace-granularity expects a number of microseconds");
+            }
+            options.timeTraceGranularity = *granularity;
+        }
+        else if (argv[i] == std::string("-o"))
+        {
+            if (i + 1 >= argc)
+            {
+                return usageError("-o requires a file name");
+            }
+            options.Output = argv[++i]; // Crea codice oggetto nel file (o nella directory) indicato
+        }
+        else if (std::string(argv[i]).rfind("--emit=", 0) == 0)
+        {
+            std::string kind = std::string(argv[i]).substr(7); // Formato del file prodotto da -o
+
+            if (kind == "obj")
+            {
+                options.emit = EmitKind::Object;
+            }
+            else if (kind == "asm")
+            {
+                options.emit = EmitKind::Assembly;
+            }
+            else if (kind == "llvm")
+            {
+                options.emit = EmitKind::IR;
+            }
+            else if (kind == "bc")
+            {
+                options.emit = EmitKind::Bitcode;
+            }
+            else
+            {
+                errs() << "--emit expects obj, asm, llvm or bc\n";
+                return 1;
+            }
+        }
+        else if (argv[i] == std::string("--link"))
+        {
+            options.link = true; // Collega tutti i file in input in un unico modulo (LTO)
+        }
+        else if (std::string(argv[i]).rfind("--export=", 0) == 0)
+        {
+            // Simboli che restano visibili dopo --link, separati da virgole
+            llvm::SmallVector<llvm::StringRef, 8> names;
+            llvm::StringRef(argv[i]).substr(9).split(names, ',', -1, false);
+            for (llvm::StringRef name : names)
+            {
+                options.exports.push_back(name.str());
+            }
+        }
+        else if (argv[i] == std::string("-j"))
+        {
+            auto jobs = i + 1 < argc ? parseUnsigned(argv[++i], INT32_MAX) : std::nullopt; // Compila i file in parallelo su N thread
+            if (!jobs)
+            {
+                return usageError("-j requires a number of threads");
+            }
+            options.jobs = *jobs;
+        }
+        else if (argv[i] == std::string("-O0"))
+        {
+            options.optLevel = llvm::OptimizationLevel::O0;
+            options.codegenOptLevel = llvm::CodeGenOpt::None;
+        }
+        else if (argv[i] == std::string("-O1"))
+        {
+            options.optLevel = llvm::OptimizationLevel::O1;
+            options.codegenOptLevel = llvm::CodeGenOpt::Less;
+        }
+        else if (argv[i] == std::string("-O2"))
+        {
+            options.optLevel = llvm::OptimizationLevel::O2;
+            options.codegenOptLevel = llvm::CodeGenOpt::Default;
+        }
+        else if (argv[i] == std::string("-O3"))
+        {
+            options.optLevel = llvm::OptimizationLevel::O3;
+            options.codegenOptLevel = llvm::CodeGenOpt::Aggressive;
+        }
+        else if (std::string(argv[i]).rfind("-mcpu=", 0) == 0)
+        {
+            options.CPU = std::string(argv[i]).substr(6);
+
+            if (options.CPU == "native")
+            { // CPU e feature della macchina su cui gira il compilatore
+                options.CPU = llvm::sys::getHostCPUName().str();
+                options.Features = hostCPUFeatures() + (options.Features.empty() ? "" : "," + options.Features);
+            }
+        }
+        else if (std::string(argv[i]).rfind("-mattr=", 0) == 0)
+        {
+            std::string attributes = std::string(argv[i]).substr(7); // es. +avx2,+fma,-avx512f
+            options.Features = options.Features.empty() ? attributes : options.Features + "," + attributes;
+        }
+        else if (argv[i] == std::string("--run"))
+        {
+            options.run_mode = true; // Esegue le espressioni top-level con il JIT
+        }
+        else if (argv[i] == std::string("-fmultiversion"))
+        {
+            options.multiversion = true; // Versione baseline + AVX2 scelta al caricamento
+        }
+        else if (std::string(argv[i]).rfind("-falign-arrays=", 0) == 0)
+        {
+            auto align = parseUnsigned(std::string(argv[i]).substr(15), UINT32_MAX); // Allineamento degli array, in byte
+
+            if (!align || !llvm::isPowerOf2_64(*align))
+            {
+                return usageError("-falign-arrays requires a power of two");
+            }
+            options.arrayAlign = *align;
+        }
+        else if (argv[i] == std::string("-fbounds-check"))
+        {
+            options.boundsCheck = true; // Indici degli array controllati a runtime
+        }
+        else if (argv[i] == std::string("-fassume-noalias"))
+        {
+            options.assumeNoalias = true; // Gli array passati a una funzione sono sempre distinti
+        }
+        else if (argv[i] == std::string("-fno-integer-inference"))
+        {
+            options.integerInference = false; // Tutte le variabili restano double
+        }
+        else if (argv[i] == std::string("-fno-tail-recursion-to-loop"))
+        {
+            options.tailRecursionToLoop = false; // La ricorsione in coda resta una chiamata (marcata tail)
+        }
+        else if (argv[i] == std::string("-ffast-math"))
+        {
+            options.fastMath.setFast(); // Tutti i flag fast-math
+        }
+        else if (argv[i] == std::string("-ffp-contract=fast") || argv[i] == std::string("-ffp-contract=off"))
+        {
+            options.fastMath.setAllowContract(argv[i] == std::string("-ffp-contract=fast")); // Fusione di moltiplicazioni e somme in FMA
+        }
+        else if (argv[i] == std::string("-fno-signed-zeros"))
+        {
+            options.fastMath.setNoSignedZeros(); // Il segno degli zeri può essere ignorato
+        }
+        else if (argv[i] == std::string("-freciprocal-math"))
+        {
+            options.fastMath.setAllowReciprocal(); // x / y può diventare x * (1 / y)
+        }
+        else if (std::string(argv[i]).rfind("-fcache-dir=", 0) == 0)
+        {
+            options.cacheDir = std::string(argv[i]).substr(12); // Cache delle funzioni compilate fra un'esecuzione e l'altra
+        }
+        else if (std::string(argv[i]).rfind("-fstack-array-limit=", 0) == 0)
+        {
+            auto limit = parseUnsigned(std::string(argv[i]).substr(20), UINT64_MAX); // Dimensione massima (byte) di un array sullo stack
+            if (!limit)
+            {
+                return usageError("-fstack-array-limit expects a size in bytes");
+            }
+            options.stackArrayLimit = *limit;
+        }
+        else
+        {
+            inputFiles.push_back(argv[i]);
+        }
+
+        i++;
+    }
+
     /***********************************************************************/
     /********* Inizializzazione del target (local machine) *****************/
     /***********************************************************************/
+    // Eseguita una sola volta, prima di avviare i thread di compilazione
+    setPhaseMemoryTracking(options.print_stats);
+    if (options.timeTrace)
+    {
+        llvm::timeTraceProfilerInitialize(options.timeTraceGranularity, "kfe");
+    }
+    bool batch = !options.link && (options.jobs > 0 || inputFiles.size() > 1);
+    // Senza un nome esplicito la traccia va accanto all'unico file di output
+    std::string traceName = !batch && options.Output != "" && options.Output != "-" ? options.Output : "kfe";
+
+    std::optional<llvm::TimeTraceScope> targetSetup;
+    targetSetup.emplace("Target setup");
     llvm::InitializeAllTargetInfos();
     llvm::InitializeAllTargets();
     llvm::InitializeAllTargetMCs();
@@ -20,7 +840,6 @@ int main(int argc, char* argv[])
     llvm::InitializeAllAsmPrinters();
 
     auto TargetTriple = llvm::sys::getDefaultTargetTriple();
-    drv.module->setTargetTriple(TargetTriple);
     std::string Error;
     auto Target = llvm::TargetRegistry::lookupTarget(TargetTriple, Error);
     if (!Target)
@@ -28,74 +847,104 @@ int main(int argc, char* argv[])
         llvm::errs() << Error;
         return 1;
     }
-    /************************** Set-up macchina target ********************/
-    auto CPU = "generic";
-    auto Features = "";
-    TargetOptions opt;
-    auto RM = std::optional<llvm::Reloc::Model>();
-    auto TheTargetMachine = Target->createTargetMachine(TargetTriple, CPU, Features, opt, RM);
-    /************************* Configurazione del modulo *****************/
-    drv.module->setDataLayout(TheTargetMachine->createDataLayout());
-    drv.module->setTargetTriple(TargetTriple);
+    targetSetup.reset();
     /***********************************************************************/
     /************* Fine set-up per creazione codice oggetto ****************/
     /***********************************************************************/
-    int i = 1;
-    std::string Filename = ""; // Il default è che il codice oggetto non viene generato
 
-    while (i < argc)
+    if (options.cacheDir != "" && !options.run_mode && !prepareCacheDir(options))
     {
-        if (argv[i] == std::string("-p"))
-        {
-            drv.trace_parsing = true; // Abilita tracce debug nel parser
-        }
-        else if (argv[i] == std::string("-s"))
+        options.cacheDir = "";
+    }
+
+    if (options.run_mode)
+    {
+        return finishTimeTrace(options, traceName, runFiles(options, TargetTriple, inputFiles));
+    }
+
+    if (options.link)
+    {
+        return finishTimeTrace(options, traceName, linkFiles(options, Target, TargetTriple, inputFiles));
+    }
+
+    if (batch && options.Output == "-")
+    {
+        errs() << "-o - requires a single input file\n";
+        return 1;
+    }
+
+    if (!batch)
+    {
+        for (const auto& inputFile : inputFiles)
         {
-            drv.trace_scanning = true; // Abilita tracce debug nello scanner
+            exitCode |= compileFile(options, Target, TargetTriple, inputFile, objectFileName(options, inputFile, batch), true);
         }
-        else if (argv[i] == std::string("-v"))
+
+        return finishTimeTrace(options, traceName, exitCode);
+    }
+
+    if (options.Output != "")
+    {
+        std::error_code EC = llvm::sys::fs::create_directories(options.Output);
+        if (EC)
         {
-            drv.ast_print = true; // Stampa una rapp. esterna dell'AST
+            errs() << "Could not create directory " << options.Output << ": " << EC.message() << "\n";
+            return 1;
         }
-        else if (argv[i] == std::string("-o"))
-        {
-            Filename = argv[++i] + (std::string) ".o"; // Crea codice oggetto nel file indicato
-        }
-        else if (!drv.parse(argv[i]))
-        { // Parsing e creazione dell'AST
-            drv.codegen(); // Visita AST e generazione dell'IR (su stdout)
-            if (Filename != "")
-            {
-                /*****************************************************************/
-                /******************** Generazione codice oggetto *****************/
-                /*****************************************************************/
-                std::error_code EC;
-                raw_fd_ostream dest(Filename, EC, sys::fs::OF_None);
-                if (EC)
-                {
-                    errs() << "Could not open file: " << EC.message();
-                    return 1;
-                }
-                legacy::PassManager pass;
-                auto FileType = CGFT_ObjectFile;
-                if (TheTargetMachine->addPassesToEmitFile(pass, dest, nullptr, FileType))
-                {
-                    errs() << "TheTargetMachine can't emit a file of this type";
-                    return 1;
-                }
-                pass.run(*drv.module); // Compilazione dell'IR prodotto dal frontend
-                dest.flush();
-                outs() << "Wrote " << Filename << "\n";
-                return 0;
+    }
+
+    /***********************************************************************/
+    /**************** Compilazione parallela (batch) ***********************/
+    /***********************************************************************/
+    std::vector<CompileResult> results(inputFiles.size());
+    llvm::ThreadPool pool(llvm::hardware_concurrency(options.jobs));
+
+    for (size_t f = 0; f < inputFiles.size(); f++)
+    {
+        pool.async([&, f]() {
+            auto start = std::chrono::steady_clock::now();
+
+            // Il profiler è per thread: ogni file ha la sua traccia, unita
+            // alle altre quando viene scritta
+            if (options.timeTrace)
+            {
+                llvm::timeTraceProfilerInitialize(options.timeTraceGranularity, inputFiles[f]);
+            }
+
+            results[f].exitCode = compileFile(options, Target, TargetTriple, inputFiles[f], objectFileName(options, inputFiles[f], batch), false);
+
+            if (options.timeTrace)
+            {
+                llvm::timeTraceProfilerFinishThread();
             }
+
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            results[f].milliseconds = elapsed.count();
+        });
+    }
+
+    pool.wait();
+
+    // Report: un file per riga, nell'ordine della riga di comando
+    unsigned failed = 0;
+    for (size_t f = 0; f < inputFiles.size(); f++)
+    {
+        std::string objectFile = objectFileName(options, inputFiles[f], batch);
+
+        outs() << inputFiles[f] << ": " << (results[f].exitCode ? "FAILED" : "ok");
+        if (!results[f].exitCode && objectFile != "")
+        {
+            outs() << " -> " << objectFile;
         }
-        else
+        outs() << " (" << llvm::format("%.1f", results[f].milliseconds) << " ms)\n";
+
+        if (results[f].exitCode)
         {
+            failed++;
             exitCode = 1;
         }
-
-        i++;
     }
+    outs() << inputFiles.size() - failed << "/" << inputFiles.size() << " files compiled\n";
 
-    return exitCode;
+    return finishTimeTrace(options, traceName, exitCode);
 }
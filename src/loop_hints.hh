@@ -0,0 +1,13 @@
+#ifndef LOOP_HINTS_HH
+#define LOOP_HINTS_HH
+
+/// LoopHints - Indicazioni esplicite del programmatore per un ciclo
+/// (for ... unroll 4 vectorize in ... end), tradotte in metadati llvm.loop
+struct LoopHints
+{
+    unsigned unroll = 0; // Fattore di unrolling, 0 = scelto da LLVM
+    bool vectorize = false; // Richiede la vettorizzazione del ciclo
+    unsigned vectorWidth = 0; // Larghezza dei vettori, 0 = scelta da LLVM
+};
+
+#endif
@@ -0,0 +1,121 @@
+#include "multiversion.hh"
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/GlobalIFunc.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <string>
+#include <vector>
+
+// Bit di __cpu_model.__cpu_features[0], come li dispongono libgcc e compiler-rt
+static constexpr unsigned FEATURE_AVX2 = 10;
+static constexpr unsigned FEATURE_FMA = 14;
+
+static const char* AVX2_SUFFIX = ".avx2";
+static const char* DEFAULT_SUFFIX = ".default";
+
+// Emette il resolver: inizializza il modello della CPU del runtime e
+// restituisce il clone AVX2 se l'host supporta sia AVX2 sia FMA
+static llvm::Function* createResolver(llvm::Module& module, const std::string& name, llvm::Function* baseline, llvm::Function* avx2)
+{
+    llvm::LLVMContext& context = module.getContext();
+    auto* ptrTy = llvm::PointerType::get(context, 0);
+    auto* int32Ty = llvm::Type::getInt32Ty(context);
+
+    auto* cpuModelTy = llvm::StructType::get(context, {int32Ty, int32Ty, int32Ty, llvm::ArrayType::get(int32Ty, 1)});
+    auto* cpuModel = module.getOrInsertGlobal("__cpu_model", cpuModelTy);
+    auto cpuInit = module.getOrInsertFunction("__cpu_indicator_init", llvm::FunctionType::get(llvm::Type::getVoidTy(context), false));
+
+    auto* resolver = llvm::Function::Create(llvm::FunctionType::get(ptrTy, false), llvm::Function::InternalLinkage, name + ".resolver", module);
+    auto* entry = llvm::BasicBlock::Create(context, "entry", resolver);
+    llvm::IRBuilder<> builder(entry);
+
+    builder.CreateCall(cpuInit);
+
+    llvm::Value* featuresAddress = builder.CreateConstInBoundsGEP2_32(cpuModelTy, cpuModel, 0, 3);
+    llvm::Value* features = builder.CreateLoad(int32Ty, featuresAddress);
+    unsigned mask = (1u << FEATURE_AVX2) | (1u << FEATURE_FMA);
+    llvm::Value* masked = builder.CreateAnd(features, mask);
+    llvm::Value* hasAvx2 = builder.CreateICmpEQ(masked, llvm::ConstantInt::get(int32Ty, mask));
+
+    builder.CreateRet(builder.CreateSelect(hasAvx2, avx2, baseline));
+
+    return resolver;
+}
+
+bool emitMultiversions(llvm::Module& module, const llvm::TargetMachine& targetMachine)
+{
+    if (!targetMachine.getTargetTriple().isX86())
+    {
+        return false;
+    }
+
+    std::vector<llvm::Function*> definitions;
+
+    for (auto& function : module)
+    {
+        if (!function.isDeclaration() && function.hasExternalLinkage())
+        {
+            definitions.push_back(&function);
+        }
+    }
+
+    // Ogni funzione originale diventa il clone di base; le chiamate fra
+    // funzioni di base restano dirette
+    std::vector<std::pair<llvm::Function*, llvm::Function*>> clones;
+    llvm::ValueToValueMapTy calleeMap;
+
+    for (llvm::Function* baseline : definitions)
+    {
+        llvm::ValueToValueMapTy vmap;
+        llvm::Function* avx2 = llvm::CloneFunction(baseline, vmap);
+        std::string name = baseline->getName().str();
+
+        baseline->setName(name + DEFAULT_SUFFIX);
+        baseline->setLinkage(llvm::Function::InternalLinkage);
+        avx2->setName(name + AVX2_SUFFIX);
+        avx2->setLinkage(llvm::Function::InternalLinkage);
+
+        // Il clone mantiene le feature scelte con -mattr e aggiunge AVX2/FMA
+        std::string features = targetMachine.getTargetFeatureString().str();
+
+        if (!features.empty())
+        {
+            features += ",";
+        }
+
+        avx2->addFnAttr("target-features", features + "+avx,+avx2,+fma");
+
+        calleeMap[baseline] = avx2;
+        clones.emplace_back(baseline, avx2);
+
+        llvm::Function* resolver = createResolver(module, name, baseline, avx2);
+        llvm::GlobalIFunc::create(baseline->getFunctionType(), 0, llvm::Function::ExternalLinkage, name, resolver, &module);
+    }
+
+    // Nei cloni AVX2 le chiamate alle altre funzioni con più versioni vanno
+    // direttamente al loro clone AVX2 invece di passare per l'ifunc
+    for (const auto& [baseline, avx2] : clones)
+    {
+        for (auto& block : *avx2)
+        {
+            for (auto& instruction : block)
+            {
+                if (auto* call = llvm::dyn_cast<llvm::CallInst>(&instruction))
+                {
+                    auto it = calleeMap.find(call->getCalledFunction());
+
+                    if (it != calleeMap.end())
+                    {
+                        call->setCalledFunction(llvm::cast<llvm::Function>(it->second));
+                    }
+                }
+            }
+        }
+    }
+
+    return true;
+}
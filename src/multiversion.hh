@@ -0,0 +1,13 @@
+#ifndef MULTIVERSION_HH
+#define MULTIVERSION_HH
+
+#include <llvm/IR/Module.h>
+#include <llvm/Target/TargetMachine.h>
+
+// Clona ogni funzione definita nel modulo in una versione di base e in una
+// AVX2/FMA, e sostituisce il simbolo originale con un ifunc che sceglie
+// quella giusta al caricamento dell'oggetto. Sono supportati solo i target
+// x86: su ogni altra architettura restituisce false (e non tocca il modulo).
+bool emitMultiversions(llvm::Module&, const llvm::TargetMachine&);
+
+#endif
@@ -1,5 +1,6 @@
 #include "operator.hh"
 #include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <ostream>
 #include <stdexcept>
@@ -14,6 +15,46 @@ const Operator& convertStringToOperator(const std::string& str)
     return OPERATOR_TABLE.at(str);
 }
 
+bool isComparison(Operator op)
+{
+    switch (op)
+    {
+        case Operator::LESS_THAN:
+        case Operator::LESS_EQUAL:
+        case Operator::GREATER_THAN:
+        case Operator::GREATER_EQUAL:
+        case Operator::EQUAL:
+        case Operator::NOT_EQUAL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool compareUnordered(Operator op, double l, double r)
+{
+    if (std::isnan(l) || std::isnan(r))
+        return true;
+
+    switch (op)
+    {
+        case Operator::LESS_THAN:
+            return l < r;
+        case Operator::LESS_EQUAL:
+            return l <= r;
+        case Operator::GREATER_THAN:
+            return l > r;
+        case Operator::GREATER_EQUAL:
+            return l >= r;
+        case Operator::EQUAL:
+            return l == r;
+        case Operator::NOT_EQUAL:
+            return l != r;
+        default:
+            throw std::invalid_argument("Not a comparison operator.");
+    }
+}
+
 std::ostream& operator<<(std::ostream& out, const Operator& op)
 {
     auto it = std::find_if(OPERATOR_TABLE.begin(), OPERATOR_TABLE.end(), [&op](const auto& pair) {
@@ -21,6 +21,13 @@ enum class Operator
 
 const Operator& convertStringToOperator(const std::string&);
 
+// Operatori di confronto: valgono 1.0 o 0.0
+bool isComparison(Operator);
+
+// Valuta un confronto con la semantica dei predicati fcmp u* usati nella
+// generazione del codice: il risultato è vero se uno degli operandi è NaN
+bool compareUnordered(Operator, double, double);
+
 std::ostream& operator<<(std::ostream&, const Operator&);
 
 #endif
\ No newline at end of file
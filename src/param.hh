@@ -0,0 +1,15 @@
+#ifndef PARAM_HH
+#define PARAM_HH
+
+#include "interner.hh"
+
+/// Param - Parametro formale di una funzione: un double passato per valore
+/// oppure un array (x[]) passato per indirizzo, che nell'IR è un double*
+/// verso memoria del chiamante (di dimensione non nota)
+struct Param
+{
+    Symbol name;
+    bool array = false;
+};
+
+#endif
@@ -9,6 +9,9 @@
 %define parse.assert
 
 %code requires {
+  #include "interner.hh"
+  #include "loop_hints.hh"
+  #include "param.hh"
   #include <string>
   #include <exception>
   #include <utility>
@@ -16,7 +19,6 @@
   class RootAST;
   class ExprAST;
   class FunctionAST;
-  class SeqAST;
   class PrototypeAST;
   class IfExprNode;
   class ForExprAST;
@@ -37,6 +39,18 @@
 %code {
 #include "driver.hh"
 #include "operator.hh"
+#include <cmath>
+
+// Valore di unroll N o vectorize N: un intero fra 1 e max (una potenza di
+// due per la larghezza dei vettori)
+static unsigned loopHintValue(const yy::location& loc, const std::string& hint, double value, unsigned max, bool powerOfTwo)
+{
+    bool valid = value == std::trunc(value) && value >= 1 && value <= max;
+    if (!valid || (powerOfTwo && (unsigned(value) & (unsigned(value) - 1))))
+        throw yy::parser::syntax_error(loc, hint + " expects " + (powerOfTwo ? "a power of two" : "an integer") +
+                                                " between 1 and " + std::to_string(max));
+    return unsigned(value);
+}
 }
 
 %define api.token.prefix {TOK_}
@@ -71,28 +85,31 @@
   END        "end"
   VAR        "var"
   WHILE      "while"
+  UNROLL     "unroll"
+  VECTORIZE  "vectorize"
+  FAST       "fast"
 ;
 
-%token <std::string> IDENTIFIER "id"
+%token <Symbol> IDENTIFIER "id"
 %token <double> NUMBER "number"
 
 %type <ExprAST*> exp
 %type <ExprAST*> idexp
 %type <std::vector<ExprAST*>> optexp
 %type <std::vector<ExprAST*>> explist
-%type <RootAST*> program
 %type <RootAST*> top
 %type <FunctionAST*> definition
 %type <PrototypeAST*> external
 %type <PrototypeAST*> proto
-%type <std::vector<std::string>> idseq
+%type <std::vector<Param>> idseq
 %type <IfExprNode*> ifexpr
 %type <ForExprAST*> forexpr
 %type <ExprAST*> step
+%type <LoopHints> loophints
 %type <VarExprAST*> varexpr
 %type <ExprAST*> assignment
-%type <std::vector<std::pair<std::string, ExprAST*>>> varlist
-%type <std::pair<std::string, ExprAST*>> pair
+%type <std::vector<std::pair<Symbol, ExprAST*>>> varlist
+%type <std::pair<Symbol, ExprAST*>> pair
 %type <WhileExprAST*> whileexpr
 %type <ArrayInitExprAST*> arrayinitexpr
 %type <ArrayIndexingExprAST*> arrayindexexpr
@@ -108,12 +125,15 @@
 %start startsymb;
 
 startsymb
-  : program { drv.root = $1; }
+  : program
 ;
 
+// Ricorsiva a sinistra: ogni elemento top-level viene compilato (e il suo
+// AST rilasciato) appena ridotto, così né lo stack del parser né l'AST
+// crescono con il numero di definizioni nel file
 program
-  : %empty          { $$ = new SeqAST(nullptr, nullptr); }
-  | top ";" program { $$ = new SeqAST($1, $3); }
+  : %empty
+  | program top ";" { if ($2) drv.codegen($2); }
 ;
 
 top
@@ -124,8 +144,10 @@ top
 ;
 
 definition
-  : "def" proto exp { $$ = new FunctionAST($2, $3); 
+  : "def" proto exp { $$ = drv.make<FunctionAST>($2, $3); 
                       $2->noemit(); }
+  | "def" "fast" proto exp { $$ = drv.make<FunctionAST>($3, $4, true);
+                             $3->noemit(); }
 ;
 
 external
@@ -133,27 +155,30 @@ external
 ;
 
 proto
-  : "id" "(" idseq ")" { $$ = new PrototypeAST($1,$3); }
+  : "id" "(" idseq ")" { $$ = drv.make<PrototypeAST>($1, drv.save(std::move($3))); }
 ;
 
+// Le liste sono ricorsive a sinistra e crescono con push_back sul valore
+// semantico spostato: costruire una lista di n elementi costa O(n)
 idseq
-  : %empty     { std::vector<std::string> args; $$ = args; }
-  | "id" idseq { $2.insert($2.begin(), $1); $$ = $2; }
+  : %empty     { }
+  | idseq "id"         { $$ = std::move($1); $$.push_back({$2, false}); }
+  | idseq "id" "[" "]" { $$ = std::move($1); $$.push_back({$2, true}); }
 ;
 
 exp
-  : "-" exp %prec NEG { $$ = new UnaryExprAST(convertStringToOperator("-"), $2); } // unary '-' must have higher precedence than the binary one
-  | exp "+" exp       { $$ = new BinaryExprAST(convertStringToOperator("+"), $1, $3); }
-  | exp "-" exp       { $$ = new BinaryExprAST(convertStringToOperator("-"), $1, $3); }
-  | exp "*" exp       { $$ = new BinaryExprAST(convertStringToOperator("*"), $1, $3); }
-  | exp "/" exp       { $$ = new BinaryExprAST(convertStringToOperator("/"), $1, $3); }
-  | exp "<" exp       { $$ = new BinaryExprAST(convertStringToOperator("<"), $1, $3); }
-  | exp "<=" exp      { $$ = new BinaryExprAST(convertStringToOperator("<="), $1, $3); }
-  | exp ">" exp       { $$ = new BinaryExprAST(convertStringToOperator(">"), $1, $3); }
-  | exp ">=" exp      { $$ = new BinaryExprAST(convertStringToOperator(">="), $1, $3); }
-  | exp "==" exp      { $$ = new BinaryExprAST(convertStringToOperator("=="), $1, $3); }
-  | exp "!=" exp      { $$ = new BinaryExprAST(convertStringToOperator("!="), $1, $3); }
-  | exp ":" exp       { $$ = new BinaryExprAST(convertStringToOperator(":"), $1, $3); }
+  : "-" exp %prec NEG { $$ = drv.make<UnaryExprAST>(Operator::MINUS, $2); } // unary '-' must have higher precedence than the binary one
+  | exp "+" exp       { $$ = drv.make<BinaryExprAST>(Operator::PLUS, $1, $3); }
+  | exp "-" exp       { $$ = drv.make<BinaryExprAST>(Operator::MINUS, $1, $3); }
+  | exp "*" exp       { $$ = drv.make<BinaryExprAST>(Operator::STAR, $1, $3); }
+  | exp "/" exp       { $$ = drv.make<BinaryExprAST>(Operator::SLASH, $1, $3); }
+  | exp "<" exp       { $$ = drv.make<BinaryExprAST>(Operator::LESS_THAN, $1, $3); }
+  | exp "<=" exp      { $$ = drv.make<BinaryExprAST>(Operator::LESS_EQUAL, $1, $3); }
+  | exp ">" exp       { $$ = drv.make<BinaryExprAST>(Operator::GREATER_THAN, $1, $3); }
+  | exp ">=" exp      { $$ = drv.make<BinaryExprAST>(Operator::GREATER_EQUAL, $1, $3); }
+  | exp "==" exp      { $$ = drv.make<BinaryExprAST>(Operator::EQUAL, $1, $3); }
+  | exp "!=" exp      { $$ = drv.make<BinaryExprAST>(Operator::NOT_EQUAL, $1, $3); }
+  | exp ":" exp       { $$ = drv.make<BinaryExprAST>(Operator::COLON, $1, $3); }
   | ifexpr            { $$ = $1; }
   | forexpr           { $$ = $1; }
   | whileexpr         { $$ = $1; }
@@ -162,21 +187,21 @@ exp
   | idexp             { $$ = $1; }
   | arrayindexexpr    { $$ = $1; }
   | "(" exp ")"       { $$ = $2; }
-  | "number"          { $$ = new NumberExprAST($1); }
+  | "number"          { $$ = drv.make<NumberExprAST>($1); }
 ;
 
 idexp
-  : "id"                { $$ = new VariableExprAST($1); }
-  | "id" "(" optexp ")" { $$ = new CallExprAST($1,$3); }
+  : "id"                { $$ = drv.make<VariableExprAST>($1); }
+  | "id" "(" optexp ")" { $$ = drv.make<CallExprAST>($1, drv.save(std::move($3))); }
 ;
 
 ifexpr
-  : "if" exp "then" exp "end"            { $$ = new IfExprNode($2, $4, nullptr); }
-  | "if" exp "then" exp "else" exp "end" { $$ = new IfExprNode($2, $4, $6); }
+  : "if" exp "then" exp "end"            { $$ = drv.make<IfExprNode>($2, $4, nullptr); }
+  | "if" exp "then" exp "else" exp "end" { $$ = drv.make<IfExprNode>($2, $4, $6); }
 ;
 
 forexpr
-  : "for" "id" "=" exp "," exp step "in" exp "end" { $$ = new ForExprAST($2, $4, $6, $7, $9); }
+  : "for" "id" "=" exp "," exp step loophints "in" exp "end" { $$ = drv.make<ForExprAST>($2, $4, $6, $7, $10, $8); }
 ;
 
 step
@@ -184,50 +209,53 @@ step
   | "," exp { $$ = $2; }
 ;
 
+loophints
+  : %empty                          { }
+  | loophints "unroll" "number"     { $$ = $1; $$.unroll = loopHintValue(@3, "unroll", $3, 1024, false); }
+  | loophints "vectorize"           { $$ = $1; $$.vectorize = true; }
+  | loophints "vectorize" "number"  { $$ = $1; $$.vectorize = true; $$.vectorWidth = loopHintValue(@3, "vectorize", $3, 64, true); }
+;
+
 optexp
-  : %empty  { std::vector<ExprAST*> args; args.push_back(nullptr); $$ = args; }
-  | explist { $$ = $1; }
+  : %empty  { }
+  | explist { $$ = std::move($1); }
 ;
 
 explist
-  : exp { 
-          std::vector<ExprAST*> args; 
-          args.push_back($1); 
-          $$ = args; 
-        }
-  | exp "," explist { $3.insert($3.begin(), $1); $$ = $3; }
+  : exp             { $$.push_back($1); }
+  | explist "," exp { $$ = std::move($1); $$.push_back($3); }
 ;
 
 varexpr
-  : "var" varlist "in" exp "end"    { $$ = new VarExprAST($2, $4); }
+  : "var" varlist "in" exp "end"    { $$ = drv.make<VarExprAST>(drv.save(std::move($2)), $4); }
 ;
 
 varlist
-  : pair             { std::vector<std::pair<std::string, ExprAST*>> list; list.push_back($1); $$ = list; }
-  | pair "," varlist { $3.insert($3.begin(), $1); $$ = $3; }
+  : pair             { $$.push_back(std::move($1)); }
+  | varlist "," pair { $$ = std::move($1); $$.push_back(std::move($3)); }
 ;
 
 pair
-  : "id"          { $$ = std::pair($1, new NumberExprAST(0.0)); }
+  : "id"          { $$ = std::pair($1, drv.make<NumberExprAST>(0.0)); }
   | "id" "=" exp  { $$ = std::pair($1, $3); }
   | arrayinitexpr { $$ = std::pair($1->getName(), $1); }
 ;
 
 assignment
-  : "id" "=" exp           { $$ = new BinaryExprAST(convertStringToOperator("="), new VariableExprAST($1), $3); }
-  | arrayindexexpr "=" exp { $$ = new BinaryExprAST(convertStringToOperator("="), $1, $3); }
+  : "id" "=" exp           { $$ = drv.make<BinaryExprAST>(Operator::ASSIGN, drv.make<VariableExprAST>($1), $3); }
+  | arrayindexexpr "=" exp { $$ = drv.make<BinaryExprAST>(Operator::ASSIGN, $1, $3); }
 ;
 
 whileexpr
-  : "while" exp "in" exp "end" { $$ = new WhileExprAST($2, $4); }
+  : "while" exp loophints "in" exp "end" { $$ = drv.make<WhileExprAST>($2, $5, $3); }
 ;
 
 arrayinitexpr
-  : "id" "[" "number" "]" { $$ = new ArrayInitExprAST($1, static_cast<unsigned int>($3)); }
+  : "id" "[" "number" "]" { $$ = drv.make<ArrayInitExprAST>($1, static_cast<unsigned int>($3)); }
 ;
 
 arrayindexexpr
-  : "id" "[" exp "]" { $$ = new ArrayIndexingExprAST($1, $3); }
+  : "id" "[" exp "]" { $$ = drv.make<ArrayIndexingExprAST>($1, $3); }
 ;
 %%
 
@@ -4,6 +4,11 @@
 #include <cstdlib>
 #include <string>
 #include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "driver.hh"
 #include "parser.hh"
 
@@ -12,12 +17,10 @@
 // not conform to C89.  See Debian bug 333231
 // <http://bugs.debian.org/cgi-bin/bugreport.cgi?bug=333231>.
 # undef yywrap
-# define yywrap() 1
-
-yy::parser::symbol_type check_keywords(std::string lexeme, yy::location& loc);
+# define yywrap(yyscanner) 1
 %}
 
-%option noyywrap nounput batch debug noinput
+%option reentrant noyywrap nounput batch debug noinput
 
 id      [a-zA-Z][a-zA-Z_0-9]*
 fpnum   [0-9]*\.?[0-9]+([eE][-+]?[0-9]+)?
@@ -58,6 +61,20 @@ blank   [ \t]
 ","    return yy::parser::make_COMMA(loc);
 ":"    return yy::parser::make_COLON(loc);
 
+"def"     return yy::parser::make_DEF(loc); // keywords come before {id}: on equal length the first rule wins
+"extern"  return yy::parser::make_EXTERN(loc);
+"if"      return yy::parser::make_IF(loc);
+"then"    return yy::parser::make_THEN(loc);
+"else"    return yy::parser::make_ELSE(loc);
+"for"     return yy::parser::make_FOR(loc);
+"in"      return yy::parser::make_IN(loc);
+"end"     return yy::parser::make_END(loc);
+"var"     return yy::parser::make_VAR(loc);
+"while"   return yy::parser::make_WHILE(loc);
+"unroll"    return yy::parser::make_UNROLL(loc);
+"vectorize" return yy::parser::make_VECTORIZE(loc);
+"fast"      return yy::parser::make_FAST(loc);
+
 {num} {
     errno = 0;
     double n = strtod(yytext, NULL);
@@ -66,75 +83,88 @@ blank   [ \t]
     return yy::parser::make_NUMBER (n, loc);
 }
 
-{id}       return check_keywords(yytext, loc);
+{id}       return yy::parser::make_IDENTIFIER(drv.interner.intern(llvm::StringRef(yytext, yyleng)), loc);
 .          { throw yy::parser::syntax_error(loc, "invalid character: " + std::string(yytext)); }
 <<EOF>>    return yy::parser::make_EOF(loc);
 %%
 
-yy::parser::symbol_type check_keywords(std::string lexeme, yy::location& loc)
+// Mappa in memoria un file regolare e ne restituisce l'indirizzo, oppure
+// nullptr se il file non si presta (pipe, file vuoto, mmap non disponibile).
+// flex richiede che il buffer termini con due byte YY_END_OF_BUFFER_CHAR:
+// si riserva una regione anonima (azzerata) di size+2 byte e vi si
+// sovrappone il file, così i sentinella sono già al loro posto senza copiare
+// il contenuto. La mappatura è privata e scrivibile perché flex termina
+// yytext scrivendo temporaneamente uno '\0' nel buffer.
+static char* mapSource(int fd, size_t& mapSize)
 {
-    if (lexeme == "def") 
-    {
-        return yy::parser::make_DEF(loc);
-    } 
-    else if (lexeme == "extern") 
-    {
-        return yy::parser::make_EXTERN(loc);
-    }
-    else if (lexeme == "if")
-    {
-        return yy::parser::make_IF(loc);
-    }
-    else if (lexeme == "then")
-    {
-        return yy::parser::make_THEN(loc);
-    }
-    else if (lexeme == "else")
-    {
-        return yy::parser::make_ELSE(loc);
-    }
-    else if (lexeme == "for")
-    {
-        return yy::parser::make_FOR(loc);
-    }
-    else if (lexeme == "in")
-    {
-        return yy::parser::make_IN(loc);
-    }
-    else if (lexeme == "end")
-    {
-        return yy::parser::make_END(loc);
-    }
-    else if (lexeme == "var")
-    {
-        return yy::parser::make_VAR(loc);
-    }
-    else if (lexeme == "while")
-    {
-        return yy::parser::make_WHILE(loc);
-    }
-    else
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+        return nullptr;
+
+    size_t size = st.st_size;
+    mapSize = size + 2;
+    void* base = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+        return nullptr;
+    if (mmap(base, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
     {
-        return yy::parser::make_IDENTIFIER(yytext, loc);
+        munmap(base, mapSize);
+        return nullptr;
     }
+    madvise(base, mapSize, MADV_SEQUENTIAL);
+    return static_cast<char*>(base);
 }
 
-void driver::scan_begin()
+bool driver::scan_begin()
 {
-    yy_flex_debug = trace_scanning;
+    FILE* in = nullptr;
 
     if (file.empty() || file == "-")
     {
-        yyin = stdin;
+        in = stdin;
     }
-    else if (!(yyin = fopen(file.c_str(), "r")))
+    else
     {
-        std::cerr << "cannot open " << file << ": " << strerror(errno) << '\n';
-        exit (EXIT_FAILURE);
+        int fd = open(file.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            std::cerr << "cannot open " << file << ": " << strerror(errno) << '\n';
+            return false;
+        }
+        sourceMap = mapSource(fd, sourceMapSize);
+        // La mappatura resta valida anche dopo la chiusura del descrittore
+        if (sourceMap)
+            close(fd);
+        else if (!(in = fdopen(fd, "r")))
+        {
+            std::cerr << "cannot open " << file << ": " << strerror(errno) << '\n';
+            close(fd);
+            return false;
+        }
     }
+
+    yylex_init(&scanner);
+    yyset_debug(trace_scanning, scanner);
+    if (sourceMap)
+        yy_scan_buffer(sourceMap, sourceMapSize, scanner);
+    else
+        yyset_in(in, scanner);
+
+    return true;
 }
 
 void driver::scan_end()
 {
-    fclose(yyin);
+    if (!sourceMap)
+        fclose(yyget_in(scanner));
+    yylex_destroy(scanner);
+    scanner = nullptr;
+
+    // Il buffer mappato non appartiene a flex: yylex_destroy non lo libera
+    if (sourceMap)
+    {
+        munmap(sourceMap, sourceMapSize);
+        sourceMap = nullptr;
+        sourceMapSize = 0;
+    }
 }
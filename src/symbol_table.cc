@@ -0,0 +1,40 @@
+#include "symbol_table.hh"
+
+void SymbolTable::enterScope()
+{
+    marks.push_back(shadowed.size());
+}
+
+void SymbolTable::exitScope()
+{
+    size_t mark = marks.back();
+    marks.pop_back();
+
+    // Ripristina i binding nascosti in ordine inverso, così un nome legato
+    // due volte nello stesso scope torna al binding più esterno
+    while (shadowed.size() > mark)
+    {
+        current[shadowed.back().first] = shadowed.back().second;
+        shadowed.pop_back();
+    }
+}
+
+void SymbolTable::bind(Symbol name, Binding slot)
+{
+    if (name >= current.size())
+        current.resize(name + 1);
+
+    shadowed.emplace_back(name, current[name]);
+    current[name] = slot;
+}
+
+Binding SymbolTable::lookup(Symbol name) const
+{
+    return name < current.size() ? current[name] : Binding();
+}
+
+void SymbolTable::reset()
+{
+    while (!marks.empty())
+        exitScope();
+}
@@ -0,0 +1,55 @@
+#ifndef SYMBOL_TABLE_HH
+#define SYMBOL_TABLE_HH
+
+#include "interner.hh"
+#include <cstddef>
+#include <llvm/IR/Type.h>
+#include <llvm/IR/Value.h>
+#include <utility>
+#include <vector>
+
+// Memoria associata a un nome: l'indirizzo (alloca, o blocco sullo heap per
+// gli array grandi) e il tipo del valore che vi è memorizzato (double o
+// array di double)
+struct Binding
+{
+    llvm::Value* address = nullptr;
+    llvm::Type* type = nullptr;
+};
+
+// Tabella dei simboli a scope annidati. Il legame corrente di ogni nome sta
+// in un vettore indicizzato dal Symbol, quindi la ricerca è un accesso
+// diretto e non alloca. Ogni nuovo legame salva quello che nasconde in una
+// pila piatta di (simbolo, slot); uscire da uno scope ripristina le voci
+// fino al segno registrato all'ingresso, un'operazione costante per voce.
+class SymbolTable
+{
+  private:
+    std::vector<Binding> current; // current[sym]: legame visibile, address nullptr se assente
+    std::vector<std::pair<Symbol, Binding>> shadowed; // Legami nascosti, nell'ordine di definizione
+    std::vector<size_t> marks; // Altezza di shadowed all'ingresso di ogni scope
+
+  public:
+    void enterScope();
+    void exitScope();
+    void bind(Symbol name, Binding slot);
+    Binding lookup(Symbol name) const;
+    void reset(); // Chiude tutti gli scope aperti (es. dopo un errore)
+
+    // Apre uno scope e lo chiude all'uscita dal blocco, anche se la
+    // generazione del codice termina con un'eccezione
+    class Scope
+    {
+      private:
+        SymbolTable& table;
+
+      public:
+        explicit Scope(SymbolTable& table) :
+            table(table) { table.enterScope(); }
+        ~Scope() { table.exitScope(); }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+};
+
+#endif
@@ -0,0 +1,192 @@
+#include "tail_calls.hh"
+#include "ast_node.hh"
+#include "driver.hh"
+#include <llvm/ADT/STLExtras.h>
+#include <vector>
+
+namespace
+{
+
+bool isColon(ExprAST* expr)
+{
+    auto* binary = llvm::dyn_cast<BinaryExprAST>(expr);
+    return binary && binary->getOp() == Operator::COLON;
+}
+
+// Riscrive
+//
+//     def f(p1, ..., pn) body
+//
+// come
+//
+//     def f(p1, ..., pn)
+//         var tail.loop = 1, tail.result in
+//             (while tail.loop : tail.result = body') : tail.result
+//
+// dove, nelle posizioni in coda di body', una chiamata ricorsiva
+// f(e1, ..., en) diventa l'assegnamento dei suoi argomenti ai parametri e
+// ogni altra espressione e diventa (tail.loop = 0 : e)
+class TailRecursionEliminator
+{
+  private:
+    driver& drv;
+    Symbol name;
+    llvm::ArrayRef<Param> params;
+    Symbol loop;
+
+    ExprAST* number(double value) { return drv.make<NumberExprAST>(value); }
+    ExprAST* variable(Symbol symbol) { return drv.make<VariableExprAST>(symbol); }
+    ExprAST* binary(Operator op, ExprAST* lhs, ExprAST* rhs) { return drv.make<BinaryExprAST>(op, lhs, rhs); }
+
+    // I parametri vengono assegnati dentro il ciclo: un blocco var che ne
+    // ridichiara uno catturerebbe gli assegnamenti destinati al parametro
+    bool shadowsParameter(VarExprAST* block) const
+    {
+        return llvm::any_of(block->getVarNames(), [this](const std::pair<Symbol, ExprAST*>& binding) {
+            return llvm::any_of(params, [&](const Param& param) { return param.name == binding.first; });
+        });
+    }
+
+    bool isSelfCall(ExprAST* expr) const
+    {
+        auto* call = llvm::dyn_cast<CallExprAST>(expr);
+        if (!call || call->getCallee() != name || call->getArgs().size() != params.size())
+            return false;
+
+        // Un parametro array non può essere riassegnato, solo passato invariato
+        for (unsigned i = 0; i < params.size(); ++i)
+        {
+            auto* argument = llvm::dyn_cast<VariableExprAST>(call->getArgs()[i]);
+            if (params[i].array && (!argument || argument->getName() != params[i].name))
+                return false;
+        }
+        return true;
+    }
+
+    bool isArgumentUnchanged(CallExprAST* call, unsigned i) const
+    {
+        auto* argument = llvm::dyn_cast<VariableExprAST>(call->getArgs()[i]);
+        return argument && argument->getName() == params[i].name;
+    }
+
+    // I parametri prendono i nuovi argomenti tutti insieme: ogni argomento
+    // viene valutato in una temporanea prima di assegnare il primo
+    ExprAST* nextIteration(CallExprAST* call)
+    {
+        std::vector<unsigned> changed;
+        for (unsigned i = 0; i < params.size(); ++i)
+            if (!params[i].array && !isArgumentUnchanged(call, i))
+                changed.push_back(i);
+
+        if (changed.empty())
+            return number(0);
+        if (changed.size() == 1)
+            return binary(Operator::ASSIGN, variable(params[changed[0]].name), call->getArgs()[changed[0]]);
+
+        std::vector<std::pair<Symbol, ExprAST*>> temporaries;
+        ExprAST* assignments = nullptr;
+        for (unsigned i : changed)
+        {
+            Symbol temporary = drv.interner.intern("tail.arg" + std::to_string(i));
+            temporaries.push_back({temporary, call->getArgs()[i]});
+
+            ExprAST* assignment = binary(Operator::ASSIGN, variable(params[i].name), variable(temporary));
+            assignments = assignments ? binary(Operator::COLON, assignments, assignment) : assignment;
+        }
+        return drv.make<VarExprAST>(drv.save(std::move(temporaries)), assignments);
+    }
+
+    unsigned countCalls(ExprAST* expr) const
+    {
+        if (isSelfCall(expr))
+            return 1;
+        if (isColon(expr))
+            return countCalls(llvm::cast<BinaryExprAST>(expr)->getRHS());
+        if (auto* ifExpr = llvm::dyn_cast<IfExprNode>(expr); ifExpr && ifExpr->getElse())
+            return countCalls(ifExpr->getThen()) + countCalls(ifExpr->getElse());
+        if (auto* block = llvm::dyn_cast<VarExprAST>(expr); block && !shadowsParameter(block))
+            return countCalls(block->getBody());
+        return 0;
+    }
+
+    ExprAST* rewrite(ExprAST* expr)
+    {
+        if (isSelfCall(expr))
+            return nextIteration(llvm::cast<CallExprAST>(expr));
+        if (isColon(expr))
+        {
+            ExprAST*& rhs = llvm::cast<BinaryExprAST>(expr)->getRHS();
+            rhs = rewrite(rhs);
+            return expr;
+        }
+        if (auto* ifExpr = llvm::dyn_cast<IfExprNode>(expr); ifExpr && ifExpr->getElse())
+        {
+            ifExpr->getThen() = rewrite(ifExpr->getThen());
+            ifExpr->getElse() = rewrite(ifExpr->getElse());
+            return expr;
+        }
+        if (auto* block = llvm::dyn_cast<VarExprAST>(expr); block && !shadowsParameter(block))
+        {
+            block->getBody() = rewrite(block->getBody());
+            return expr;
+        }
+        return binary(Operator::COLON, binary(Operator::ASSIGN, variable(loop), number(0)), expr);
+    }
+
+  public:
+    TailRecursionEliminator(driver& drv, FunctionAST* function) :
+        drv(drv), name(function->getProto()->getName()), params(function->getProto()->getArgs()),
+        loop(drv.interner.intern("tail.loop")) {}
+
+    bool run(FunctionAST* function)
+    {
+        ExprAST*& body = function->getBody();
+        if (!countCalls(body))
+            return false;
+
+        Symbol result = drv.interner.intern("tail.result");
+        ExprAST* iteration = binary(Operator::ASSIGN, variable(result), rewrite(body));
+        ExprAST* loopExpr = drv.make<WhileExprAST>(variable(loop), iteration, LoopHints{});
+
+        std::vector<std::pair<Symbol, ExprAST*>> state = {{loop, number(1)}, {result, number(0)}};
+        body = drv.make<VarExprAST>(drv.save(std::move(state)), binary(Operator::COLON, loopExpr, variable(result)));
+        return true;
+    }
+};
+
+// direct: al valore segue solo il ritorno dalla funzione, quindi qui una
+// chiamata può essere musttail. Non lo sono il corpo di un blocco var, dopo
+// il quale possono essere liberati array sullo heap, né i rami di un if,
+// che si uniscono in un phi.
+void markTailPositions(ExprAST* expr, bool direct)
+{
+    if (auto* call = llvm::dyn_cast<CallExprAST>(expr))
+        call->setTail(direct ? TailCall::MustTail : TailCall::Tail);
+    else if (isColon(expr))
+        markTailPositions(llvm::cast<BinaryExprAST>(expr)->getRHS(), direct);
+    else if (auto* ifExpr = llvm::dyn_cast<IfExprNode>(expr); ifExpr && ifExpr->getElse())
+    {
+        markTailPositions(ifExpr->getThen(), false);
+        markTailPositions(ifExpr->getElse(), false);
+    }
+    else if (auto* block = llvm::dyn_cast<VarExprAST>(expr))
+        markTailPositions(block->getBody(), false);
+}
+
+} // namespace
+
+void eliminateTailRecursion(driver& drv, RootAST* node)
+{
+    auto* function = llvm::dyn_cast<FunctionAST>(node);
+    if (!drv.tailRecursionToLoop || !function)
+        return;
+
+    if (TailRecursionEliminator(drv, function).run(function))
+        ++drv.tailRecursiveFunctions;
+}
+
+void markTailCalls(RootAST* node)
+{
+    if (auto* function = llvm::dyn_cast<FunctionAST>(node))
+        markTailPositions(function->getBody(), true);
+}
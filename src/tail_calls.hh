@@ -0,0 +1,26 @@
+#ifndef TAIL_CALLS_HH
+#define TAIL_CALLS_HH
+
+class driver;
+class RootAST;
+
+// Posizioni di coda di una funzione: il suo corpo e, ricorsivamente,
+// entrambi i rami di un if con else, l'operando destro di ':' e il corpo di
+// un blocco var. Il valore di un'espressione in posizione di coda è quello
+// restituito dalla funzione.
+
+// Riscrive come ciclo una definizione che chiama se stessa in posizione di
+// coda: ogni chiamata ricorsiva diventa l'assegnamento dei nuovi argomenti
+// ai parametri seguito da una nuova iterazione, ogni altra posizione di coda
+// termina il ciclo con il proprio valore. La ricorsione usa così uno spazio
+// costante sullo stack anche a -O0. I parametri array devono essere passati
+// invariati; altrimenti, o con -fno-tail-recursion-to-loop, la definizione
+// resta com'è.
+void eliminateTailRecursion(driver& drv, RootAST* node);
+
+// Marca le chiamate in posizione di coda (CallExprAST::setTail), che la
+// generazione del codice emette come tail, o musttail se nulla le separa
+// dal ret e il prototipo coincide con quello della funzione chiamante.
+void markTailCalls(RootAST* node);
+
+#endif
@@ -0,0 +1,27 @@
+#!/bin/sh
+# Controllo degli indici (-fbounds-check) nei cicli for: un accesso dentro
+# un if non deve far fallire il controllo anticipato nel preheader, mentre
+# un accesso eseguito a ogni iterazione oltre la capacità termina il programma.
+# Uso: tests/bounds.sh (dalla radice del repository, dopo make all)
+
+KFE=${KFE:-bin/kfe}
+DIR=tests/bounds
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+status=0
+
+if ! "$KFE" -fbounds-check --run $DIR/conditional.k > "$TMP/out.txt" 2> "$TMP/err.txt"; then
+    echo "FAIL: accesso condizionale fuori dai limiti mai eseguito"; cat "$TMP/err.txt"; status=1
+elif ! diff -u $DIR/expected.txt "$TMP/out.txt"; then
+    echo "FAIL: output di conditional.k"; status=1
+else
+    echo "ok: accesso dentro un if controllato solo quando eseguito"
+fi
+
+if "$KFE" -fbounds-check --run $DIR/overflow.k > /dev/null 2>&1; then
+    echo "FAIL: l'accesso oltre la capacità non termina il programma"; status=1
+else
+    echo "ok: accesso oltre la capacità rilevato"
+fi
+
+exit $status
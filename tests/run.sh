@@ -0,0 +1,27 @@
+#!/bin/sh
+# Esecuzione con --run di più file in un solo JIT: il secondo file chiama
+# una funzione definita nel primo, il terzo prova a ridefinirla.
+# Uso: tests/run.sh (dalla radice del repository, dopo make all)
+
+KFE=${KFE:-bin/kfe}
+DIR=tests/run
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+status=0
+
+if ! "$KFE" --run $DIR/lib.k $DIR/main.k > "$TMP/out.txt" 2> "$TMP/err.txt"; then
+    echo "FAIL: --run lib.k main.k"; cat "$TMP/err.txt"; status=1
+elif ! diff -u $DIR/expected.txt "$TMP/out.txt"; then
+    echo "FAIL: output di --run lib.k main.k"; status=1
+else
+    echo "ok: chiamata a una funzione di un file precedente"
+fi
+
+"$KFE" --run $DIR/lib.k $DIR/redefine.k > /dev/null 2> "$TMP/err.txt"
+if grep -q "sq già definita" "$TMP/err.txt"; then
+    echo "ok: ridefinizione rifiutata"
+else
+    echo "FAIL: la ridefinizione di sq non viene segnalata"; cat "$TMP/err.txt"; status=1
+fi
+
+exit $status